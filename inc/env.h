@@ -39,6 +39,31 @@ enum {
     ENV_NOT_RUNNABLE
 };
 
+/* NUMA memory policies (see sys_env_set_mempolicy) */
+enum MemPolicy {
+    MPOL_LOCAL,      /* Prefer memory of the node env runs on */
+    MPOL_INTERLEAVE, /* Spread allocations over allowed nodes */
+    MPOL_BIND,       /* Allocate only from allowed nodes */
+};
+
+/* Fair share scheduling weights (see sys_env_set_weight) */
+#define SCHED_WEIGHT_MIN     1
+#define SCHED_WEIGHT_DEFAULT 1024
+#define SCHED_WEIGHT_MAX     65536
+
+/* Real-time reservation limits (see sys_env_set_rt) */
+#define SCHED_RT_RUNTIME_MIN_US 100      /* Smaller budgets are dominated by overhead */
+#define SCHED_RT_PERIOD_MAX_US  10000000 /* 10 s */
+#define SCHED_RT_UTIL_MAX_PCT   95       /* The rest is left to fair share envs */
+
+/* Real-time class statistics */
+struct EnvRtStats {
+    uint64_t jobs;        /* Jobs completed with sys_yield() */
+    uint64_t misses;      /* Jobs that didn't complete before their deadline */
+    uint64_t overruns;    /* Jobs throttled because budget was exhausted (also misses) */
+    uint64_t max_late_us; /* Maximal lateness of completed jobs */
+};
+
 /* Special environment types */
 enum EnvType {
     ENV_TYPE_IDLE,
@@ -51,20 +76,105 @@ struct List {
 };
 
 struct AddressSpace {
-    pml4e_t *pml4;     /* Virtual address of pml4 */
-    uintptr_t cr3;     /* Physical address of pml4 */
-    struct Page *root; /* root node of address space tree */
+    pml4e_t *pml4;            /* Virtual address of pml4 */
+    uintptr_t cr3;            /* Physical address of pml4 */
+    struct Page *root;        /* root node of address space tree */
+    uintptr_t release_cursor; /* Teardown progress, see release_address_space_step() */
+    struct Env *env;          /* Owner, NULL for kspace and snapshot images */
+};
+
+/* Range of virtual memory with uniform mapping
+ * attributes (see sys_region_extents) */
+struct MapExtent {
+    uintptr_t start; /* Start address */
+    size_t size;     /* Size in bytes */
+    int prot;        /* PROT_* flags, including PROT_SHARE and PROT_LAZY */
+    int class;       /* log2(page size) - 12 of underlying pages */
+};
+
+/* Region mapping descriptor (see sys_map_regions) */
+struct MapRegion {
+    uintptr_t src; /* Source address */
+    uintptr_t dst; /* Destination address */
+    size_t size;   /* Size in bytes */
+    int perm;      /* Same as sys_map_region() perm */
 };
 
+/* Maximal number of 64-bit words in register IPC message
+ * (see sys_ipc_send_regs). Words are passed in rdx, rcx, rbx,
+ * rdi, rsi and r8, receiver's envid goes to the upper half of rax */
+#define IPC_MAX_WORDS 6
+
+/* Maximal depth of IPC mailbox (see sys_ipc_mailbox) */
+#define IPC_MAILBOX_MAX 64
+
+/* Message queued in IPC mailbox */
+struct IpcMessage {
+    envid_t from;   /* Sender */
+    uint32_t value; /* Value sent (low 32 bits of the first word) */
+    uintptr_t va;   /* Granted region, MAX_USER_ADDRESS if none */
+    size_t size;    /* Size of granted region */
+    int perm;       /* Perm of granted region */
+    uint64_t words[IPC_MAX_WORDS]; /* Words of sys_ipc_send_regs(), value for other sends */
+};
+
+/* Maximal number of events in sys_wait() set */
+#define WAIT_MAX_EVENTS 8
+
+/* Event types of sys_wait() */
+enum WaitType {
+    WAIT_IPC = 1, /* Message from 'envid' (0 - any) is pending */
+    WAIT_FUTEX,   /* Word at 'addr' doesn't contain 'value' or was woken up */
+    WAIT_TIMER,   /* 'deadline' (ns since boot, see vsys_gettime()) passed */
+    WAIT_CONSOLE, /* Console input is available */
+};
+
+struct WaitEvent {
+    enum WaitType type;
+    envid_t envid;     /* WAIT_IPC */
+    uintptr_t addr;    /* WAIT_FUTEX */
+    uint32_t value;    /* WAIT_FUTEX */
+    uint64_t deadline; /* WAIT_TIMER */
+};
+
+/* Link in futex waiter queue, one per event of sys_wait() */
+struct FutexNode {
+    struct Env *env;
+    physaddr_t key;         /* Physical address of the word, 0 if not queued */
+    struct FutexNode *next; /* Next waiter in the same hash bucket */
+};
 
 struct Env {
     struct Trapframe env_tf; /* Saved registers */
     struct Env *env_link;    /* Next free Env */
+    struct Env *env_list_next, *env_list_prev; /* Links in EnvList (list of dying envs) */
     envid_t env_id;          /* Unique environment identifier */
     envid_t env_parent_id;   /* env_id of this env's parent */
     enum EnvType env_type;   /* Indicates special system environments */
     unsigned env_status;     /* Status of the environment */
     uint32_t env_runs;       /* Number of times environment has run */
+    envid_t env_destroyer;   /* curenv at env_destroy(), reported when env is freed */
+
+    /* Fair share scheduling (see kern/sched.c) */
+    uint32_t env_weight;       /* CPU share relative to other envs */
+    uint32_t env_rq_index;     /* Position in run queue heap */
+    uint64_t env_rq_seq;       /* Enqueue order, breaks ties in run queues */
+    uint64_t env_vruntime;     /* Consumed TSC cycles scaled by SCHED_WEIGHT_DEFAULT / env_weight */
+    uint64_t env_runtime;      /* Consumed TSC cycles */
+    uint64_t env_runtime_mark; /* env_runtime at the last 'sched' monitor command */
+    uint64_t env_sched_stamp;  /* TSC when env was last charged */
+    bool env_sched_blocked;    /* Sleeps in a system call (see env_sleep()) */
+
+    /* Earliest deadline first real-time class (see sys_env_set_rt),
+     * times are in TSC cycles, env_rt_period is 0 for fair share envs */
+    uint64_t env_rt_runtime;      /* Budget per period */
+    uint64_t env_rt_period;
+    uint64_t env_rt_deadline;     /* Relative to start of period */
+    uint64_t env_rt_release;      /* Start of current (or next, if throttled) period */
+    uint64_t env_rt_abs_deadline; /* Deadline of current job */
+    uint64_t env_rt_budget;       /* Budget left for current job */
+    bool env_rt_throttled;        /* Waits for env_rt_release */
+    struct EnvRtStats env_rt_stats;
 
     uint8_t *binary; /* Pointer to process ELF image in kernel memory */
 
@@ -76,11 +186,61 @@ struct Env {
 
     /* LAB 9 IPC */
     bool env_ipc_recving;    /* Env is blocked receiving */
+    envid_t env_ipc_recv_from; /* Only accept message from this env (0 - any) */
     uintptr_t env_ipc_dstva; /* VA at which to map received page */
     size_t env_ipc_maxsz;    /* maximal size of received region */
     uint32_t env_ipc_value;  /* Data value sent to us */
     envid_t env_ipc_from;    /* envid of the sender */
     int env_ipc_perm;        /* Perm of page mapping received */
+    bool env_ipc_regs;       /* Receive message words into registers */
+
+    /* Blocking IPC send (see sys_ipc_send) */
+    struct Env *env_ipc_senders;      /* Senders blocked on this env (FIFO) */
+    struct Env *env_ipc_senders_tail; /* Last sender in the queue */
+    struct Env *env_ipc_next_sender;  /* Next sender in the same queue */
+    struct Env *env_ipc_send_to;      /* Receiver this env is blocked on */
+    uint32_t env_ipc_send_value;      /* Pending message */
+    uint64_t env_ipc_send_words[IPC_MAX_WORDS];
+    uintptr_t env_ipc_send_srcva;
+    size_t env_ipc_send_size;
+    int env_ipc_send_perm;
+
+    /* Callers of sys_ipc_call() waiting for a reply */
+    struct Env *env_ipc_callers;     /* Callers waiting for reply from this env */
+    struct Env *env_ipc_next_caller; /* Links in the same list */
+    struct Env *env_ipc_prev_caller;
+    struct Env *env_ipc_call_to;     /* Env this caller waits for reply from */
+
+    /* IPC mailbox (see sys_ipc_mailbox) */
+    struct IpcMessage *env_mbox; /* Storage, kept when env slot is reused */
+    uint32_t env_mbox_depth;     /* 0 if mailbox is disabled */
+    uint32_t env_mbox_head, env_mbox_tail;
+    uintptr_t env_mbox_grant_va; /* Region of slot i is mapped at grant_va + i * grant_size */
+    size_t env_mbox_grant_size;
+    bool env_mbox_waiting;       /* Blocked in sys_ipc_recv_batch() */
+    uint64_t env_mbox_overflows; /* Messages rejected by full mailbox */
+
+    /* Futex and multiplexed wait (see sys_futex_wait, sys_wait) */
+    struct FutexNode env_futex[WAIT_MAX_EVENTS];
+    bool env_waiting;                    /* Blocked in sys_futex_wait() or sys_wait() */
+    bool env_wait_set;                   /* Return ready set of sys_wait() on wakeup */
+    uint32_t env_wait_ipc;               /* Events waiting for IPC message */
+    uint32_t env_wait_cons;              /* Events waiting for console input */
+    uint32_t env_wait_timer;             /* Events firing at env_wait_deadline */
+    envid_t env_wait_from[WAIT_MAX_EVENTS]; /* Senders of WAIT_IPC events */
+    uint64_t env_wait_deadline;          /* Timeout in ns since boot, 0 if none */
+    struct Env *env_wait_timed_next;     /* Next waiter in deadline order */
+
+    /* NUMA memory policy */
+    enum MemPolicy env_mempolicy; /* Page allocation policy */
+    uint32_t env_memnodes;        /* Allowed nodes mask (0 means all nodes) */
+    uint32_t env_mem_next;        /* Next node for MPOL_INTERLEAVE */
+
+    /* Checkpoint (see sys_env_snapshot) */
+    struct EnvSnapshot *env_snapshot;
+
+    /* User address of batched system call ring (see sys_ring_setup) */
+    struct SysRing *env_ring;
 };
 
 #endif /* !JOS_INC_ENV_H */
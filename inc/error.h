@@ -19,6 +19,10 @@ enum {
     E_NO_ENT = 10,       /* Not found */
     E_IPC_NOT_RECV = 11, /* Attempt to send to env that is not recving */
     E_EOF = 12,          /* Unexpected end of file */
+    E_MAILBOX_FULL = 13, /* Target's IPC mailbox is full */
+    E_AGAIN = 14,        /* Value changed, try again */
+    E_TIMEOUT = 15,      /* Wait timed out */
+    E_NO_CPU = 16,       /* Not enough CPU time for real-time reservation */
     MAXERROR
 };
 
@@ -17,6 +17,7 @@
 #include <inc/memlayout.h>
 #include <inc/syscall.h>
 #include <inc/trap.h>
+#include <inc/vsyscall.h>
 
 #ifdef SANITIZE_USER_SHADOW_BASE
 /* asan unpoison routine used for whitelisting regions. */
@@ -25,6 +26,9 @@ void platform_asan_poison(void *, size_t);
 /* non-sanitized memcpy and memset allow us to access "invalid" areas for extra poisoning. */
 void *__nosan_memset(void *, int, size_t);
 void *__nosan_memcpy(void *, const void *src, size_t);
+/* Heap allocator hooks: first 'size' bytes of 'chunk' become valid, the rest is redzone */
+void platform_asan_malloc(void *, size_t size, size_t chunk);
+void platform_asan_free(void *, size_t chunk);
 #endif
 
 #define USED(x) (void)(x)
@@ -34,8 +38,15 @@ void umain(int argc, char **argv);
 
 /* libmain.c or entry.S */
 extern const char *binaryname;
+#ifdef JOS_PROG
 extern const volatile struct Env *thisenv;
+#else
+/* Lives in thread-local storage, so it is correct
+ * in environments sharing address space (see sfork) */
+#define thisenv (utls->env)
+#endif
 extern const volatile struct Env envs[NENV];
+extern const volatile struct VSysPage vsys;
 
 /* exit.c */
 void exit(void);
@@ -55,6 +66,10 @@ char *readline(const char *buf);
 #define ALLOC_ZERO 0x100000 /* Allocate memory filled with 0x00 */
 #define ALLOC_ONE  0x200000 /* Allocate memory filled with 0xFF */
 
+/* IPC region transfer flag: move region to the receiver
+ * instead of sharing it (see map_region() in kern/pmap.c) */
+#define MAP_MOVE 0x400000
+
 /* Memory protection flags & attributes
  * NOTE These should be in-sync with kern/pmap.h
  * TODO Create dedicated header for them */
@@ -85,9 +100,28 @@ int sys_env_set_pgfault_upcall(envid_t env, void *upcall);
 int sys_alloc_region(envid_t env, void *pg, size_t size, int perm);
 int sys_map_region(envid_t src_env, void *src_pg,
                    envid_t dst_env, void *dst_pg, size_t size, int perm);
+int sys_map_regions(envid_t src_env, envid_t dst_env, const struct MapRegion *vec, size_t count);
 int sys_unmap_region(envid_t env, void *pg, size_t size);
 int sys_ipc_try_send(envid_t to_env, uint64_t value, void *pg, size_t size, int perm);
+int sys_ipc_send(envid_t to_env, uint64_t value, void *pg, size_t size, int perm);
 int sys_ipc_recv(void *rcv_pg, size_t size);
+int sys_ipc_call(envid_t to_env, uint64_t value, void *pg, size_t size, int perm);
+int sys_ipc_reply_recv(envid_t to_env, uint64_t value, void *rcv_pg, size_t size);
+int sys_ipc_send_regs(envid_t to_env, const uint64_t words[IPC_MAX_WORDS]);
+int sys_ipc_recv_regs(uint64_t words[IPC_MAX_WORDS]);
+int sys_ipc_mailbox(size_t depth, void *grant_va, size_t grant_size);
+int sys_ipc_recv_batch(struct IpcMessage *buf, size_t count);
+int sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint64_t timeout);
+int sys_futex_wake(volatile uint32_t *addr, int count);
+int sys_wait(const struct WaitEvent *events, size_t count);
+int sys_env_set_weight(envid_t env, uint32_t weight);
+int sys_env_set_rt(envid_t env, uint64_t runtime, uint64_t period, uint64_t deadline);
+int sys_env_set_mempolicy(envid_t env, int policy, uint32_t nodemask);
+int sys_env_snapshot(envid_t env);
+int sys_env_restore(envid_t env);
+int sys_region_extents(envid_t env, void *start, void *end, struct MapExtent *buf, size_t count);
+int sys_ring_setup(struct SysRing *ring);
+int sys_ring_enter(void);
 
 /* This must be inlined. Exercise for reader: why? */
 static inline envid_t __attribute__((always_inline))
@@ -103,11 +137,71 @@ sys_exofork(void) {
 void ipc_send(envid_t to_env, uint32_t value, void *pg, size_t size, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, size_t *psize, int *perm_store);
 envid_t ipc_find_env(enum EnvType type);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, size_t size, int perm);
+int32_t ipc_reply_and_recv(envid_t to_env, uint32_t value, envid_t *from_env_store,
+                           void *pg, size_t *psize, int *perm_store);
+void ipc_send_words(envid_t to_env, const uint64_t *words, size_t count);
+int ipc_recv_words(envid_t *from_env_store, uint64_t words[IPC_MAX_WORDS]);
+size_t ipc_recv_batch(struct IpcMessage *buf, size_t count);
 
 /* fork.c */
 envid_t fork(void);
 envid_t sfork(void);
 
+/* tls.c */
+#define TLS_KEYS 32
+
+/* Thread-local storage at USER_TLS, private to every
+ * environment even if the rest of memory is shared */
+struct Tls {
+    const volatile struct Env *env; /* thisenv */
+    void *values[TLS_KEYS];         /* Values of tls_key_create() keys */
+};
+
+#define utls ((struct Tls *)USER_TLS)
+
+int tls_key_create(void);
+void *tls_get(int key);
+void tls_set(int key, void *value);
+
+/* gthread.c */
+#define GTHREAD_MAX        64
+#define GTHREAD_STACK_SIZE (4 * PAGE_SIZE)
+/* Green thread stacks, each one is followed by a guard page */
+#define GTHREAD_STACKS 0x7000000000
+#define GCHAN_SLOTS    16
+
+/* Callee-saved state of green thread (see lib/gswitch.S) */
+struct GContext {
+    uint64_t rsp, rbx, rbp, r12, r13, r14, r15;
+    uint32_t mxcsr;
+    uint16_t fpucw;
+};
+
+struct GThread;
+
+/* FIFO of green threads */
+struct GQueue {
+    struct GThread *head, *tail;
+};
+
+/* Buffered channel between green threads of one environment */
+struct GChan {
+    uint64_t data[GCHAN_SLOTS];
+    uint32_t head, tail;
+    struct GQueue senders, receivers;
+};
+
+int gthread_create(void (*fn)(void *), void *arg);
+void gthread_yield(void);
+_Noreturn void gthread_exit(void);
+void gthread_wait_all(void);
+int gthread_self(void);
+void gthread_park_ipc(void);
+void gchan_init(struct GChan *ch);
+void gchan_send(struct GChan *ch, uint64_t value);
+uint64_t gchan_recv(struct GChan *ch);
+
 /* uvpt.c */
 int foreach_shared_region(int (*fun)(void *start, void *end, void *arg), void *arg);
 pte_t get_uvpt_entry(void *addr);
@@ -115,6 +209,78 @@ int get_prot(void *va);
 bool is_page_dirty(void *va);
 bool is_page_present(void *va);
 
+/* sysring.c */
+int sysring_init(struct SysRing *ring);
+int sysring_submit(struct SysRing *ring, uint64_t user_data, int num,
+                   uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6);
+bool sysring_complete(struct SysRing *ring, struct SysCompletion *cqe);
+
+/* chan.c */
+#define CHAN_SLOTS     512 /* Ring capacity */
+#define CHAN_DOORBELLS 4   /* Depth of mailbox used for doorbells */
+
+/* Single-producer/single-consumer channel in a shared region.
+ * Head and tail are written by different sides
+ * so they live in separate cache lines. */
+struct Chan {
+    volatile uint32_t head;     /* Next slot to read, written by consumer */
+    volatile bool prod_waiting; /* Producer sleeps until ring is not full */
+    envid_t cons;               /* Consumer env (doorbell target) */
+    uint8_t pad0[56];
+    volatile uint32_t tail;     /* Next slot to write, written by producer */
+    volatile bool cons_waiting; /* Consumer sleeps until ring is not empty */
+    envid_t prod;               /* Producer env (doorbell target) */
+    uint8_t pad1[56];
+    uint64_t data[CHAN_SLOTS];
+};
+
+int chan_create(struct Chan *ch);
+void chan_destroy(struct Chan *ch);
+void chan_send(struct Chan *ch, uint64_t value);
+uint64_t chan_recv(struct Chan *ch);
+
+/* mutex.c
+ * Mutex and condition variable shared between
+ * environments should be placed in PROT_SHARE memory */
+struct Mutex {
+    volatile uint32_t state; /* 0 - unlocked, 1 - locked, 2 - locked and contended */
+};
+
+struct CondVar {
+    volatile uint32_t seq; /* Incremented by every signal */
+};
+
+void mutex_lock(struct Mutex *mtx);
+bool mutex_trylock(struct Mutex *mtx);
+void mutex_unlock(struct Mutex *mtx);
+void cond_wait(struct CondVar *cv, struct Mutex *mtx);
+void cond_signal(struct CondVar *cv);
+void cond_broadcast(struct CondVar *cv);
+
+/* malloc.c */
+/* Virtual range reserved for heap */
+#define MALLOC_BASE 0x3000000000
+#define MALLOC_SIZE 0x1000000000
+
+struct MallocStats {
+    size_t slabs;          /* Slabs in use */
+    size_t slabs_released; /* Empty slabs whose memory was unmapped */
+    size_t large;          /* Large objects */
+    size_t large_bytes;    /* Memory mapped for large objects */
+};
+
+void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
+void free(void *ptr);
+void malloc_stats(struct MallocStats *stats);
+
+/* vsyscall.c */
+envid_t vsys_getenvid(void);
+uint32_t vsys_env_runs(void);
+uint64_t vsys_gettime(void);
+uint64_t vsys_ticks(void);
+
 #ifdef JOS_PROG
 extern void (*volatile sys_exit)(void);
 extern void (*volatile sys_yield)(void);
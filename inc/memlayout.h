@@ -16,8 +16,10 @@
 #define GD_KD   0x10 /* kernel data */
 #define GD_KT32 0x18 /* kernel text 32bit */
 #define GD_KD32 0x20 /* kernel data 32bit */
-#define GD_UT   0x28 /* user text */
-#define GD_UD   0x30 /* user data */
+/* NOTE: SYSRET requires user text selector
+ * to immediately follow user data selector */
+#define GD_UD   0x28 /* user data */
+#define GD_UT   0x30 /* user text */
 #define GD_TSS0 0x38 /* Task segment selector for CPU 0 */
 
 /*
@@ -65,12 +67,16 @@
  *                     .                              .
  * MAX_USER_ADDRESS,               .                              .
  *USER_EXCEPTION_STACK_TOP +-_------------------------+ 0x8000000000
- *                     |     User Exception Stack     | RW/RW  PAGE_SIZE
- *                     +------------------------------+ 0x7ffffff000
+ *                     |     User Exception Stack     | RW/RW  8 * PAGE_SIZE
+ *                     +------------------------------+ 0x7fffff8000
  *                     |       Empty Memory (*)       | --/--  PAGE_SIZE
- * USER_STACK_TOP -->  +------------------------------+ 0x7fffffe000
- *                     |      Normal User Stack       | RW/RW  PAGE_SIZE
- *                     +------------------------------+ 0x7fffffd000
+ * USER_STACK_TOP -->  +------------------------------+ 0x7fffff7000
+ *                     |      Normal User Stack       | RW/RW  16 * PAGE_SIZE
+ *                     +------------------------------+ 0x7ffffe7000
+ *                     |       Empty Memory (*)       | --/--  PAGE_SIZE
+ *                     +------------------------------+ 0x7ffffe6000
+ *                     |     Thread-Local Storage     | RW/RW  PAGE_SIZE
+ *    USER_TLS ----->  +------------------------------+ 0x7ffffe5000
  *                     |                              |
  *                     |                              |
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -164,6 +170,10 @@
 #define USER_STACK_TOP (USER_EXCEPTION_STACK_TOP - USER_EXCEPTION_STACK_SIZE - PAGE_SIZE)
 /* Stack size (variable) */
 #define USER_STACK_SIZE (16 * PAGE_SIZE)
+/* Thread-local storage, next page left invalid to guard against stack overflow.
+ * Everything from USER_TLS and up is private to environments created by sfork() */
+#define USER_TLS_SIZE PAGE_SIZE
+#define USER_TLS      (USER_STACK_TOP - USER_STACK_SIZE - PAGE_SIZE - USER_TLS_SIZE)
 /* Max number of open files in the file system at once */
 #define MAXOPEN   512
 #define FILE_BASE 0x200000000
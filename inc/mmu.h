@@ -141,10 +141,19 @@
 
 /* x86_64 related changes */
 #define EFER_MSR 0xC0000080
+#define EFER_SCE (1ULL << 0)
 #define EFER_LME (1ULL << 8)
 #define EFER_LMA (1ULL << 10)
 #define EFER_NXE (1ULL << 11)
 
+/* SYSCALL/SYSRET MSRs */
+#define MSR_STAR   0xC0000081 /* Segment selectors */
+#define MSR_LSTAR  0xC0000082 /* 64-bit mode entry point */
+#define MSR_SFMASK 0xC0000084 /* RFLAGS mask */
+
+/* CPUID 0x80000001 EDX feature bits */
+#define CPUID_EXT_SYSCALL (1U << 11) /* SYSCALL/SYSRET */
+
 /* RFLAGS register */
 #define FL_CF        0x00000001 /* Carry Flag */
 #define FL_PF        0x00000004 /* Parity Flag */
@@ -1,6 +1,8 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+
 /* system call numbers */
 enum {
     SYS_cputs = 0,
@@ -18,7 +20,50 @@ enum {
     SYS_yield,
     SYS_ipc_try_send,
     SYS_ipc_recv,
+    SYS_env_set_mempolicy,
+    SYS_env_snapshot,
+    SYS_env_restore,
+    SYS_region_extents,
+    SYS_ring_setup,
+    SYS_ring_enter,
+    SYS_map_regions,
+    SYS_ipc_send,
+    SYS_ipc_call,
+    SYS_ipc_reply_recv,
+    SYS_ipc_send_regs,
+    SYS_ipc_recv_regs,
+    SYS_ipc_mailbox,
+    SYS_ipc_recv_batch,
+    SYS_futex_wait,
+    SYS_futex_wake,
+    SYS_wait,
+    SYS_env_set_weight,
+    SYS_env_set_rt,
     NSYSCALLS
 };
 
+/* Batched system call ring (see sys_ring_setup).
+ * User queues entries at sq_tail, kernel consumes them at sq_head
+ * and posts results at cq_tail, user reaps them at cq_head.
+ * Indices grow monotonically and are taken modulo SYSRING_ENTRIES. */
+#define SYSRING_ENTRIES 32
+
+struct SysRingEntry {
+    uint64_t num;       /* SYS_alloc_region, SYS_map_region, SYS_unmap_region or SYS_ipc_try_send */
+    uint64_t args[6];   /* Same as system call arguments */
+    uint64_t user_data; /* Copied to the completion */
+};
+
+struct SysCompletion {
+    uint64_t user_data;
+    int64_t result;
+};
+
+struct SysRing {
+    volatile uint32_t sq_head, sq_tail;
+    volatile uint32_t cq_head, cq_tail;
+    struct SysRingEntry sq[SYSRING_ENTRIES];
+    struct SysCompletion cq[SYSRING_ENTRIES];
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -67,6 +67,9 @@
  * processor defined exceptions or interrupt vectors.*/
 #define T_SYSCALL 48  /* system call */
 #define T_DEFAULT 500 /* catchall */
+/* Not an interrupt vector: marks trapframes
+ * saved partially by SYSCALL instruction entry */
+#define T_FASTSYSCALL 501
 
 #define IRQ_OFFSET 32 /* IRQ 0 corresponds to int IRQ_OFFSET */
 
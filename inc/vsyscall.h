@@ -0,0 +1,27 @@
+#ifndef JOS_INC_VSYSCALL_H
+#define JOS_INC_VSYSCALL_H
+
+#include <inc/types.h>
+
+/* Kernel maintained page mapped read-only at UVSYS.
+ * Lets user environments get frequently used information
+ * without entering the kernel (see lib/vsyscall.c).
+ *
+ * Per-environment fields always describe the running
+ * environment and are updated by env_run() on context switch. */
+struct VSysPage {
+    /* Per-environment information */
+    int32_t envid;     /* ID of the running environment */
+    uint32_t env_runs; /* Number of times it was scheduled */
+
+    /* Monotonic clock:
+     * ns = ((tsc - tsc_base) * tsc_mult) >> tsc_shift */
+    uint64_t tsc_base;
+    uint64_t tsc_mult;
+    uint32_t tsc_shift;
+
+    /* Number of scheduler timer interrupts since boot */
+    uint64_t ticks;
+};
+
+#endif /* !JOS_INC_VSYSCALL_H */
@@ -529,6 +529,15 @@ cons_getc(void) {
     return 0;
 }
 
+/* Returns true if console input is available without consuming it */
+bool
+cons_pending(void) {
+    serial_intr();
+    kbd_intr();
+
+    return cons.rpos != cons.wpos;
+}
+
 /* Output a character to the console */
 static void
 cons_putc(int c) {
@@ -16,6 +16,7 @@
 void cons_init(void);
 void fb_init(void);
 int cons_getc(void);
+bool cons_pending(void);
 
 /* IRQ1 */
 void kbd_intr(void);
@@ -12,6 +12,9 @@
 #include <kern/trap.h>
 #include <kern/monitor.h>
 #include <kern/sched.h>
+#include <kern/snapshot.h>
+#include <kern/vsyscall.h>
+#include <kern/wait.h>
 #include <kern/kdebug.h>
 #include <kern/macro.h>
 #include <kern/pmap.h>
@@ -33,6 +36,10 @@ struct Env *envs = NULL;
  * (linked by Env->env_link) */
 static struct Env *env_free_list;
 
+/* Environments with ENV_DYING status in order of destruction
+ * (linked by Env->env_list_next), released by env_reclaim() */
+static struct EnvList env_dying;
+
 /* NOTE: Should be at least LOGNENV */
 #define ENVGENSHIFT 12
 
@@ -60,7 +67,7 @@ envid2env(envid_t envid, struct Env **env_store, bool need_check_perm) {
      * (i.e., does not refer to a _previous_ environment
      * that used the same slot in the envs[] array). */
     env = &envs[ENVX(envid)];
-    if (env->env_status == ENV_FREE || env->env_id != envid) {
+    if (env->env_status == ENV_FREE || env->env_status == ENV_DYING || env->env_id != envid) {
         *env_store = NULL;
         return -E_BAD_ENV;
     }
@@ -158,6 +165,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
     /* Allocate and set up the page directory for this environment. */
     int res = init_address_space(&env->address_space);
     if (res < 0) return res;
+    env->address_space.env = env;
 
     /* Generate an env_id for this environment */
     int32_t generation = (env->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
@@ -172,8 +180,11 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
 #else
     env->env_type = type;
 #endif
-    env->env_status = ENV_RUNNABLE;
     env->env_runs = 0;
+    env->env_weight = SCHED_WEIGHT_DEFAULT;
+    env->env_runtime = env->env_runtime_mark = 0;
+    memset(&env->env_rt_stats, 0, sizeof(env->env_rt_stats));
+    env_set_status(env, ENV_RUNNABLE);
 
     /* Clear out all the saved register state,
      * to prevent the register values
@@ -218,6 +229,28 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
 
     /* Also clear the IPC receiving flag. */
     env->env_ipc_recving = 0;
+    env->env_ipc_recv_from = 0;
+    env->env_ipc_regs = false;
+    env->env_mbox_depth = env->env_mbox_head = env->env_mbox_tail = 0;
+    env->env_mbox_waiting = false;
+    env->env_mbox_overflows = 0;
+    memset(env->env_futex, 0, sizeof(env->env_futex));
+    env->env_waiting = false;
+    env->env_wait_ipc = env->env_wait_cons = env->env_wait_timer = 0;
+    env->env_wait_deadline = 0;
+    env->env_wait_timed_next = NULL;
+    env->env_ipc_senders = env->env_ipc_senders_tail = NULL;
+    env->env_ipc_next_sender = env->env_ipc_send_to = NULL;
+    env->env_ipc_callers = env->env_ipc_next_caller = env->env_ipc_prev_caller = NULL;
+    env->env_ipc_call_to = NULL;
+
+    /* Allocate memory close to the CPU by default */
+    env->env_mempolicy = MPOL_LOCAL;
+    env->env_memnodes = 0;
+    env->env_mem_next = 0;
+
+    env->env_snapshot = NULL;
+    env->env_ring = NULL;
 
     /* Commit the allocation */
     env_free_list = env->env_link;
@@ -510,6 +543,9 @@ load_icode(struct Env *env, uint8_t *binary, size_t size) {
     int res = map_region(&env->address_space, USER_STACK_TOP - USER_STACK_SIZE, NULL, 0, USER_STACK_SIZE, PROT_R | PROT_W | PROT_USER_ | ALLOC_ZERO);
     if (res < 0) panic("load_icode: %i \n", res);
 
+    res = map_region(&env->address_space, USER_TLS, NULL, 0, USER_TLS_SIZE, PROT_R | PROT_W | PROT_USER_ | ALLOC_ZERO);
+    if (res < 0) panic("load_icode: %i \n", res);
+
     return 0;
 }
 
@@ -538,13 +574,75 @@ env_create(uint8_t *binary, size_t size, enum EnvType type) {
 }
 
 
-/* Frees env and all memory it uses */
 void
-env_free(struct Env *env) {
+env_list_append(struct EnvList *list, struct Env *env) {
+    env->env_list_next = NULL;
+    env->env_list_prev = list->tail;
+    if (list->tail)
+        list->tail->env_list_next = env;
+    else
+        list->head = env;
+    list->tail = env;
+}
+
+void
+env_list_remove(struct EnvList *list, struct Env *env) {
+    if (env->env_list_prev)
+        env->env_list_prev->env_list_next = env->env_list_next;
+    else
+        list->head = env->env_list_next;
+    if (env->env_list_next)
+        env->env_list_next->env_list_prev = env->env_list_prev;
+    else
+        list->tail = env->env_list_prev;
+    env->env_list_next = env->env_list_prev = NULL;
+}
+
+/* Changes status of env keeping the run queue and the list
+ * of dying environments up to date. Every status transition
+ * except initialization in env_init() goes through here */
+void
+env_set_status(struct Env *env, unsigned status) {
+    unsigned prev = env->env_status;
+    if (prev == status) return;
+
+    if (prev == ENV_RUNNABLE) sched_dequeue(env);
+    if (prev == ENV_DYING) env_list_remove(&env_dying, env);
+
+    env->env_status = status;
+    if (status == ENV_NOT_RUNNABLE) env->env_sched_blocked = false;
+
+    if (status == ENV_RUNNABLE) sched_enqueue(env, prev);
+    if (status == ENV_DYING) env_list_append(&env_dying, env);
+
+    /* Release real-time reservation */
+    if ((status == ENV_DYING || status == ENV_FREE) && env->env_rt_period) sched_set_rt(env, 0, 0, 0);
+}
+
+/* Blocks env in a system call until the kernel wakes it up.
+ * Unlike suspension with sys_env_set_status(), the wakeup
+ * gets scheduling credit (see sched_enqueue()) */
+void
+env_sleep(struct Env *env) {
+    env_set_status(env, ENV_NOT_RUNNABLE);
+    env->env_sched_blocked = true;
+}
 
+/* Returns env to the free list */
+static void
+env_put(struct Env *env) {
     /* Note the environment's demise. */
-    if (trace_envs) cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, env->env_id);
+    if (trace_envs) cprintf("[%08x] free env %08x\n", env->env_destroyer, env->env_id);
 
+    /* Return the environment to the free list */
+    env_set_status(env, ENV_FREE);
+    env->env_link = env_free_list;
+    env_free_list = env;
+}
+
+/* Frees env and all memory it uses */
+void
+env_free(struct Env *env) {
 #ifndef CONFIG_KSPACE
     /* If freeing the current environment, switch to kern_pgdir
      * before freeing the page directory, just in case the page
@@ -555,38 +653,173 @@ env_free(struct Env *env) {
     static_assert(MAX_USER_ADDRESS % HUGE_PAGE_SIZE == 0, "Misaligned MAX_USER_ADDRESS");
     release_address_space(&env->address_space);
 #endif
+    snapshot_release_step(env, (size_t)-1);
 
-    /* Return the environment to the free list */
-    env->env_status = ENV_FREE;
-    env->env_link = env_free_list;
-    env_free_list = env;
+    env->env_destroyer = curenv ? curenv->env_id : 0;
+    env_put(env);
+}
+
+/* Releases part of memory used by dying env
+ * and frees env once all of its memory is released.
+ * Returns true if env is freed */
+bool
+env_free_step(struct Env *env) {
+    assert(env->env_status == ENV_DYING);
+
+#ifndef CONFIG_KSPACE
+    if (&env->address_space == current_space)
+        switch_address_space(&kspace);
+
+    if (env->address_space.pml4 &&
+        !release_address_space_step(&env->address_space, ENV_FREE_STEP_CHUNKS)) return 0;
+#endif
+    if (!snapshot_release_step(env, ENV_FREE_STEP_CHUNKS)) return 0;
+
+    env_put(env);
+    return 1;
+}
+
+/* Does a single teardown step of some dying env.
+ * Returns false if there are no dying envs */
+bool
+env_reclaim(void) {
+    if (!env_dying.head) return 0;
+
+    env_free_step(env_dying.head);
+    return 1;
 }
 
 /* Frees environment env
+ *
+ * Environment is marked as ENV_DYING and its memory
+ * is released incrementally by the scheduler.
  *
  * If env was the current one, then runs a new environment
  * (and does not return to the caller)
  */
 void
 env_destroy(struct Env *env) {
-    /* If env is currently running on other CPUs, we change its state to
-     * ENV_DYING. A zombie environment will be freed the next time
-     * it traps to the kernel. */
+    // LAB 8: Your code here (set in_page_fault = 0)
+    in_page_fault = 0;
 
-    // LAB 3: Your code here
+    /* Memory is released later, when curenv is
+     * already different (see env_reclaim()) */
+    env->env_destroyer = curenv ? curenv->env_id : 0;
+    env_set_status(env, ENV_DYING);
+    env_ipc_cancel(env);
+    wait_cancel(env);
 
-    if (env == curenv)
-    {
-        env_free(env);
+    if (env == curenv) {
+#ifndef CONFIG_KSPACE
+        switch_address_space(&kspace);
+#endif
         sched_yield();
     }
-    else 
-    {
-        env->env_status = ENV_DYING;
+}
+
+/* Queues sender blocked in sys_ipc_send() on target */
+void
+env_ipc_enqueue(struct Env *target, struct Env *sender) {
+    assert(!sender->env_ipc_send_to);
+
+    sender->env_ipc_send_to = target;
+    sender->env_ipc_next_sender = NULL;
+    if (target->env_ipc_senders_tail)
+        target->env_ipc_senders_tail->env_ipc_next_sender = sender;
+    else
+        target->env_ipc_senders = sender;
+    target->env_ipc_senders_tail = sender;
+}
+
+/* Removes the oldest sender blocked on target,
+ * returns NULL if there are none */
+struct Env *
+env_ipc_dequeue(struct Env *target) {
+    struct Env *sender = target->env_ipc_senders;
+    if (!sender) return NULL;
+
+    target->env_ipc_senders = sender->env_ipc_next_sender;
+    if (!target->env_ipc_senders) target->env_ipc_senders_tail = NULL;
+    sender->env_ipc_next_sender = sender->env_ipc_send_to = NULL;
+    return sender;
+}
+
+/* Starts closed receive of the reply from callee
+ * in sys_ipc_call(), links caller to callee's callers */
+void
+env_ipc_wait_reply(struct Env *callee, struct Env *caller) {
+    assert(!caller->env_ipc_call_to);
+
+    caller->env_ipc_recv_from = callee->env_id;
+    caller->env_ipc_call_to = callee;
+    caller->env_ipc_prev_caller = NULL;
+    caller->env_ipc_next_caller = callee->env_ipc_callers;
+    if (callee->env_ipc_callers) callee->env_ipc_callers->env_ipc_prev_caller = caller;
+    callee->env_ipc_callers = caller;
+}
+
+/* Ends closed receive of env (sets env_ipc_recv_from to any sender),
+ * unlinks env from callers of the env it was waiting for reply from */
+void
+env_ipc_recv_any(struct Env *env) {
+    env->env_ipc_recv_from = 0;
+
+    struct Env *callee = env->env_ipc_call_to;
+    if (!callee) return;
+
+    if (env->env_ipc_prev_caller)
+        env->env_ipc_prev_caller->env_ipc_next_caller = env->env_ipc_next_caller;
+    else
+        callee->env_ipc_callers = env->env_ipc_next_caller;
+    if (env->env_ipc_next_caller)
+        env->env_ipc_next_caller->env_ipc_prev_caller = env->env_ipc_prev_caller;
+    env->env_ipc_next_caller = env->env_ipc_prev_caller = env->env_ipc_call_to = NULL;
+}
+
+/* Detaches env from IPC wait queues when it is destroyed:
+ * its own blocked send is dropped, senders blocked on env
+ * and callers waiting for its reply are woken up with -E_BAD_ENV */
+void
+env_ipc_cancel(struct Env *env) {
+    struct Env *target = env->env_ipc_send_to;
+    if (target) {
+        struct Env **link = &target->env_ipc_senders, *prev = NULL;
+        while (*link != env) {
+            prev = *link;
+            link = &prev->env_ipc_next_sender;
+        }
+        *link = env->env_ipc_next_sender;
+        if (target->env_ipc_senders_tail == env) target->env_ipc_senders_tail = prev;
+        env->env_ipc_next_sender = env->env_ipc_send_to = NULL;
+    }
+    env_ipc_recv_any(env);
+
+    struct Env *sender;
+    while ((sender = env_ipc_dequeue(env))) {
+        sender->env_ipc_recving = 0;
+        env_ipc_recv_any(sender);
+        sender->env_tf.tf_regs.reg_rax = -E_BAD_ENV;
+        env_set_status(sender, ENV_RUNNABLE);
     }
 
-    // LAB 8: Your code here (set in_page_fault = 0)
-    in_page_fault = 0;
+    struct Env *caller;
+    while ((caller = env->env_ipc_callers)) {
+        assert(caller->env_ipc_recving && caller->env_status == ENV_NOT_RUNNABLE);
+        caller->env_ipc_recving = 0;
+        env_ipc_recv_any(caller);
+        caller->env_tf.tf_regs.reg_rax = -E_BAD_ENV;
+        env_set_status(caller, ENV_RUNNABLE);
+    }
+}
+
+/* Env sleeps in a system call (IPC send, receive or call,
+ * mailbox receive, futex or event wait) and is linked to
+ * some wait queue, only the kernel can wake it up */
+bool
+env_blocked(struct Env *env) {
+    return env->env_status == ENV_NOT_RUNNABLE &&
+           (env->env_ipc_send_to || env->env_ipc_recving ||
+            env->env_mbox_waiting || env->env_waiting);
 }
 
 #ifdef CONFIG_KSPACE
@@ -675,14 +908,20 @@ env_run(struct Env *env) {
 
     if (curenv != env)
     {
+        if (curenv) sched_account(curenv);
         if (curenv != NULL && curenv->env_status == ENV_RUNNING)
-            curenv->env_status =  ENV_RUNNABLE;
+            env_set_status(curenv, ENV_RUNNABLE);
 
         curenv = env;
         curenv->env_runs++;
-        curenv->env_status = ENV_RUNNING;
+        curenv->env_sched_stamp = read_tsc();
         switch_address_space(&curenv->address_space);
+        vsys_switch(curenv);
     }
 
+    /* Also takes env off the run queue */
+    env_set_status(curenv, ENV_RUNNING);
+    sched_arm_timer(curenv);
+
     env_pop_tf(&curenv->env_tf);
 }
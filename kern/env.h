@@ -22,11 +22,34 @@ struct Image_bounds
 
 static const int Loaded_segments_num = 3;
 
+/* List of environments linked by Env->env_list_next/env_list_prev,
+ * an environment is in at most one such list at a time */
+struct EnvList {
+    struct Env *head, *tail;
+};
+
+void env_list_append(struct EnvList *list, struct Env *env);
+void env_list_remove(struct EnvList *list, struct Env *env);
+void env_set_status(struct Env *env, unsigned status);
+void env_sleep(struct Env *env);
+
 void env_init(void);
 int env_alloc(struct Env **penv, envid_t parent_id, enum EnvType type);
 void env_free(struct Env *env);
 void env_create(uint8_t *binary, size_t size, enum EnvType type);
 void env_destroy(struct Env *env);
+bool env_free_step(struct Env *env);
+bool env_reclaim(void);
+void env_ipc_enqueue(struct Env *target, struct Env *sender);
+struct Env *env_ipc_dequeue(struct Env *target);
+void env_ipc_wait_reply(struct Env *callee, struct Env *caller);
+void env_ipc_recv_any(struct Env *env);
+void env_ipc_cancel(struct Env *env);
+bool env_blocked(struct Env *env);
+
+/* Amount of work done by single env_free_step()
+ * (in 2MB chunks of address space) */
+#define ENV_FREE_STEP_CHUNKS 8
 
 int envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 _Noreturn void env_run(struct Env *e);
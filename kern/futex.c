@@ -0,0 +1,87 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/futex.h>
+#include <kern/wait.h>
+
+/*
+ * Futex waiter queues.
+ *
+ * Waiters are keyed by physical address of the word, so the same
+ * word shared by several environments (PROT_SHARE) maps to the same
+ * queue. Every hash bucket is a FIFO list of FutexNode links, an
+ * environment has one link per event of sys_wait() so it can wait
+ * on several words at once. Blocking itself and timeouts are
+ * handled by kern/wait.c.
+ */
+
+static struct {
+    struct FutexNode *head, *tail;
+} futex_buckets[FUTEX_BUCKETS];
+
+static size_t
+futex_hash(physaddr_t key) {
+    return ((key >> 2) * 0x9E3779B97F4A7C15ULL) >> (64 - 6);
+}
+
+static void
+futex_unlink(struct FutexNode *node) {
+    size_t i = futex_hash(node->key);
+    struct FutexNode **link = &futex_buckets[i].head, *prev = NULL;
+    while (*link != node) {
+        assert(*link);
+        prev = *link;
+        link = &prev->next;
+    }
+    *link = node->next;
+    if (futex_buckets[i].tail == node) futex_buckets[i].tail = prev;
+    node->next = NULL;
+    node->key = 0;
+}
+
+/* Queues event 'event' of env on the word at physical address 'key'.
+ * Env is blocked separately with wait_block(). */
+void
+futex_queue(struct Env *env, int event, physaddr_t key) {
+    static_assert(FUTEX_BUCKETS == 1 << 6, "futex_hash() assumes 64 buckets");
+    struct FutexNode *node = &env->env_futex[event];
+    assert(key && !node->key);
+
+    size_t i = futex_hash(key);
+    node->env = env;
+    node->key = key;
+    node->next = NULL;
+    if (futex_buckets[i].tail)
+        futex_buckets[i].tail->next = node;
+    else
+        futex_buckets[i].head = node;
+    futex_buckets[i].tail = node;
+}
+
+/* Wakes up to 'count' oldest waiters on 'key',
+ * returns number of woken environments */
+int
+futex_wake(physaddr_t key, int count) {
+    int woken = 0;
+    size_t i = futex_hash(key);
+    while (woken < count) {
+        /* Waking dequeues all links of the env, so rescan the bucket */
+        struct FutexNode *node = futex_buckets[i].head;
+        while (node && node->key != key) node = node->next;
+        if (!node) break;
+
+        struct Env *env = node->env;
+        wait_wake(env, 1U << (node - env->env_futex));
+        woken++;
+    }
+    return woken;
+}
+
+/* Removes all links of env from futex queues */
+void
+futex_dequeue(struct Env *env) {
+    for (size_t i = 0; i < WAIT_MAX_EVENTS; i++)
+        if (env->env_futex[i].key) futex_unlink(&env->env_futex[i]);
+}
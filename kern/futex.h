@@ -0,0 +1,18 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+#define FUTEX_BUCKETS 64
+
+void futex_queue(struct Env *env, int event, physaddr_t key);
+int futex_wake(physaddr_t key, int count);
+void futex_dequeue(struct Env *env);
+
+#endif /* !JOS_KERN_FUTEX_H */
@@ -17,6 +17,9 @@
 #include <kern/picirq.h>
 #include <kern/kclock.h>
 #include <kern/kdebug.h>
+#include <kern/numa.h>
+#include <kern/kmalloc.h>
+#include <kern/vsyscall.h>
 #include <kern/traceopt.h>
 
 void
@@ -147,12 +150,20 @@ i386_init(void) {
     pic_init();
     timers_init();
 
+    /* ACPI tables are accessible only after memory init */
+    numa_init();
+
+    /* Object allocator takes pages from the closest node */
+    kmem_init();
+
     /* Framebuffer init should be done after memory init */
     fb_init();
     if (trace_init) cprintf("Framebuffer initialised\n");
 
     /* User environment initialization functions */
     env_init();
+    sched_init();
+    vsys_init();
 
     /* Choose the timer used for scheduling: hpet or pit */
     const char* picked_timer = "hpet0";
@@ -0,0 +1,516 @@
+/* Kernel object allocator.
+ *
+ * Objects of the same size are grouped into caches. A cache carves its
+ * objects from KMEM_SLAB_SIZE slabs of physical memory taken from the
+ * page allocator and accessed through the direct mapping. Slabs are
+ * naturally aligned, so slab header (and the cache object belongs to)
+ * is found by rounding object address down.
+ *
+ * On top of slabs every CPU has a pair of magazines (arrays of free
+ * objects) per cache, so most allocations and frees don't take the
+ * cache lock. When both magazines are empty, one is exchanged for a full
+ * magazine from the cache depot, when both are full one is given to the
+ * depot (Bonwick & Adams, "Magazines and Vmem", 2001).
+ *
+ * kmalloc() rounds size up to a power of two and uses one of kmalloc-N
+ * caches. Sizes above KMALLOC_MAX_SIZE are not supported, allocations
+ * that large should use kzalloc_region().
+ *
+ * Under KASAN every object is followed by a redzone and free objects
+ * (including ones sitting in magazines) are poisoned.
+ */
+
+#include <inc/assert.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/kmalloc.h>
+#include <kern/pmap.h>
+#include <kern/traceopt.h>
+
+#define KMEM_SLAB_MAGIC 0x42414C534D454BULL
+#define KMEM_EMPTY_MAX  1 /* Empty slabs kept per cache */
+#define KMALLOC_CACHES  10
+
+#ifdef SANITIZE_SHADOW_BASE
+#define KMEM_REDZONE 16
+#define NOSAN        __attribute__((no_sanitize_address))
+#define asan_alloc(p, size, chunk) platform_asan_malloc((p), (size), (chunk))
+#define asan_free(p, chunk)        platform_asan_free((p), (chunk))
+#else
+#define KMEM_REDZONE 0
+#define NOSAN
+#define asan_alloc(p, size, chunk) ((void)0)
+#define asan_free(p, chunk)        ((void)0)
+#endif
+
+struct KmemSlab {
+    struct KmemSlab *next, *prev; /* Links in partial or empty list */
+    struct KmemCache *cache;
+    struct Page *page;
+    void *free;      /* Freed objects */
+    uint32_t inuse;  /* Objects given out */
+    uint32_t carved; /* Objects ever given out, the rest was never touched */
+    uint64_t magic;
+};
+
+static struct KmemCache caches[KMEM_MAX_CACHES];
+static int ncaches;
+static struct spinlock caches_lock;
+
+static struct KmemCache *mag_cache;
+static struct KmemCache *kmalloc_caches[KMALLOC_CACHES];
+
+/* Per-CPU data is only accessed with interrupts
+ * disabled, kernel type environments are preemptible */
+static inline uint64_t
+kmem_irq_save(void) {
+    uint64_t rflags = read_rflags();
+    asm volatile("cli");
+    return rflags;
+}
+
+static inline void
+kmem_irq_restore(uint64_t rflags) {
+    if (rflags & FL_IF) asm volatile("sti");
+}
+
+/* There is only one CPU (NCPU is 1) */
+static inline struct KmemCpuCache *
+cpu_cache(struct KmemCache *cache) {
+    return &cache->cpu[0];
+}
+
+/* Links of free objects are stored in poisoned memory */
+static inline void *NOSAN
+get_link(void *obj) {
+    return *(void **)obj;
+}
+
+static inline void NOSAN
+set_link(void *obj, void *next) {
+    *(void **)obj = next;
+}
+
+static inline struct KmemSlab *
+obj_slab(void *obj) {
+    return (struct KmemSlab *)ROUNDDOWN((uintptr_t)obj, KMEM_SLAB_SIZE);
+}
+
+static void
+slab_list_add(struct KmemSlab **list, struct KmemSlab *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void
+slab_list_del(struct KmemSlab **list, struct KmemSlab *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static struct KmemSlab *
+slab_create(struct KmemCache *cache) {
+    struct Page *page = alloc_kpage(KMEM_SLAB_CLASS);
+    if (!page) return NULL;
+
+    struct KmemSlab *slab = KADDR(page2pa(page));
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_unpoison(slab, cache->offset);
+    asan_free((uint8_t *)slab + cache->offset, KMEM_SLAB_SIZE - cache->offset);
+#endif
+    *slab = (struct KmemSlab){.cache = cache, .page = page, .magic = KMEM_SLAB_MAGIC};
+    cache->nslabs++;
+    return slab;
+}
+
+static void
+slab_release(struct KmemCache *cache, struct KmemSlab *slab) {
+    assert(!slab->inuse);
+    slab->magic = 0;
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_unpoison(slab, KMEM_SLAB_SIZE);
+#endif
+    free_kpage(slab->page);
+    cache->nslabs--;
+    cache->nreleased++;
+}
+
+/* Takes an object from slabs, cache lock should be held */
+static void *
+slab_alloc(struct KmemCache *cache) {
+    struct KmemSlab *slab = cache->partial;
+    if (!slab && (slab = cache->empty)) {
+        slab_list_del(&cache->empty, slab);
+        cache->nempty--;
+        slab_list_add(&cache->partial, slab);
+    }
+    if (!slab) {
+        if (!(slab = slab_create(cache))) return NULL;
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void *obj = slab->free;
+    if (obj)
+        slab->free = get_link(obj);
+    else
+        obj = (uint8_t *)slab + cache->offset + slab->carved++ * cache->chunk;
+
+    if (++slab->inuse == cache->nobjs) slab_list_del(&cache->partial, slab);
+    cache->inuse++;
+    return obj;
+}
+
+/* Returns an object to its slab, cache lock should be held */
+static void
+slab_free(struct KmemCache *cache, void *obj) {
+    struct KmemSlab *slab = obj_slab(obj);
+
+    set_link(obj, slab->free);
+    slab->free = obj;
+    cache->inuse--;
+
+    if (slab->inuse-- == cache->nobjs) slab_list_add(&cache->partial, slab);
+    if (slab->inuse) return;
+
+    slab_list_del(&cache->partial, slab);
+    if (cache->nempty < KMEM_EMPTY_MAX) {
+        slab_list_add(&cache->empty, slab);
+        cache->nempty++;
+    } else {
+        slab_release(cache, slab);
+    }
+}
+
+/* Returns objects of magazine to slabs, cache lock should be held */
+static void
+mag_flush(struct KmemCache *cache, struct KmemMagazine *mag) {
+    while (mag->rounds)
+        slab_free(cache, mag->objs[--mag->rounds]);
+}
+
+static void *
+mag_alloc(struct KmemCache *cache, struct KmemCpuCache *cpu) {
+    for (;;) {
+        struct KmemMagazine *loaded = cpu->loaded;
+        if (loaded && loaded->rounds) return loaded->objs[--loaded->rounds];
+
+        /* Previous magazine is full, reload it */
+        if (cpu->prev && cpu->prev->rounds) {
+            cpu->loaded = cpu->prev;
+            cpu->prev = loaded;
+            continue;
+        }
+
+        /* Both are empty, take full magazine from the depot */
+        spin_lock(&cache->lock);
+        struct KmemMagazine *full = cache->depot_full;
+        if (full) {
+            cache->depot_full = full->next;
+            cache->ndepot_full--;
+            if (cpu->prev) {
+                cpu->prev->next = cache->depot_empty;
+                cache->depot_empty = cpu->prev;
+            }
+            cpu->prev = loaded;
+            cpu->loaded = full;
+        }
+        spin_unlock(&cache->lock);
+
+        if (!full) return NULL;
+    }
+}
+
+/* Returns false if there is no room for obj in magazines */
+static bool
+mag_free(struct KmemCache *cache, struct KmemCpuCache *cpu, void *obj) {
+    for (;;) {
+        struct KmemMagazine *loaded = cpu->loaded;
+        if (loaded && loaded->rounds < KMEM_MAG_ROUNDS) {
+            loaded->objs[loaded->rounds++] = obj;
+            return 1;
+        }
+
+        /* Previous magazine is empty, reload it */
+        if (cpu->prev && !cpu->prev->rounds) {
+            cpu->loaded = cpu->prev;
+            cpu->prev = loaded;
+            continue;
+        }
+
+        /* Both are full, give previous one to the depot
+         * (or flush it if depot is full) and load an empty one */
+        struct KmemMagazine *empty = NULL;
+        spin_lock(&cache->lock);
+        if (cpu->prev) {
+            if (cache->ndepot_full < KMEM_DEPOT_MAX) {
+                cpu->prev->next = cache->depot_full;
+                cache->depot_full = cpu->prev;
+                cache->ndepot_full++;
+            } else {
+                mag_flush(cache, cpu->prev);
+                empty = cpu->prev;
+            }
+            cpu->prev = NULL;
+        }
+        if (!empty && (empty = cache->depot_empty))
+            cache->depot_empty = empty->next;
+        spin_unlock(&cache->lock);
+
+        if (!empty) {
+            if (!(empty = kmem_cache_alloc(mag_cache))) return 0;
+            empty->rounds = 0;
+        }
+        cpu->prev = loaded;
+        cpu->loaded = empty;
+    }
+}
+
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, size_t align, int flags) {
+    if (!size || size > KMALLOC_MAX_SIZE) return NULL;
+
+    /* Free objects should be able to hold a link */
+    align = MAX(align, sizeof(void *));
+    if (align & (align - 1)) return NULL;
+
+    spin_lock(&caches_lock);
+    struct KmemCache *cache = ncaches < KMEM_MAX_CACHES ? &caches[ncaches++] : NULL;
+    spin_unlock(&caches_lock);
+    if (!cache) return NULL;
+
+    strlcpy(cache->name, name, sizeof cache->name);
+    cache->size = size;
+    cache->chunk = ROUNDUP(MAX(size, sizeof(void *)) + KMEM_REDZONE, align);
+    cache->offset = ROUNDUP(sizeof(struct KmemSlab), align);
+    cache->nobjs = (KMEM_SLAB_SIZE - cache->offset) / cache->chunk;
+    cache->flags = flags;
+    spin_initlock(&cache->lock);
+
+    return cache;
+}
+
+void *
+kmem_cache_alloc(struct KmemCache *cache) {
+    uint64_t rflags = kmem_irq_save();
+    void *obj = NULL;
+
+    if (!(cache->flags & KMEM_NOMAG) && (obj = mag_alloc(cache, cpu_cache(cache))))
+        cache->nmag_hit++;
+
+    if (!obj) {
+        spin_lock(&cache->lock);
+        obj = slab_alloc(cache);
+        spin_unlock(&cache->lock);
+    }
+
+    if (obj) {
+        asan_alloc(obj, cache->size, cache->chunk);
+        cache->nalloc++;
+    } else {
+        cache->nfail++;
+    }
+
+    kmem_irq_restore(rflags);
+    return obj;
+}
+
+void
+kmem_cache_free(struct KmemCache *cache, void *obj) {
+    if (!obj) return;
+
+    struct KmemSlab *slab = obj_slab(obj);
+    uintptr_t offset = (uintptr_t)obj - (uintptr_t)slab - cache->offset;
+    if (slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache ||
+        offset >= cache->nobjs * cache->chunk || offset % cache->chunk)
+        panic("kmem_cache_free: %p is not an object of %s", obj, cache->name);
+
+    uint64_t rflags = kmem_irq_save();
+
+    asan_free(obj, cache->chunk);
+    cache->nfree++;
+
+    if (cache->flags & KMEM_NOMAG || !mag_free(cache, cpu_cache(cache), obj)) {
+        spin_lock(&cache->lock);
+        slab_free(cache, obj);
+        spin_unlock(&cache->lock);
+    }
+
+    kmem_irq_restore(rflags);
+}
+
+/* Returns all cached objects to slabs and
+ * gives memory of empty slabs back to page allocator */
+void
+kmem_cache_reap(struct KmemCache *cache) {
+    uint64_t rflags = kmem_irq_save();
+    struct KmemMagazine *mags = NULL;
+
+    spin_lock(&cache->lock);
+
+    struct KmemCpuCache *cpu = cpu_cache(cache);
+    struct KmemMagazine *local[] = {cpu->loaded, cpu->prev};
+    cpu->loaded = cpu->prev = NULL;
+    for (size_t i = 0; i < sizeof(local) / sizeof(*local); i++) {
+        if (!local[i]) continue;
+        local[i]->next = cache->depot_empty;
+        cache->depot_empty = local[i];
+    }
+
+    while (cache->depot_full) {
+        struct KmemMagazine *mag = cache->depot_full;
+        cache->depot_full = mag->next;
+        mag->next = cache->depot_empty;
+        cache->depot_empty = mag;
+    }
+    cache->ndepot_full = 0;
+
+    for (struct KmemMagazine *mag = cache->depot_empty; mag; mag = mag->next)
+        mag_flush(cache, mag);
+    mags = cache->depot_empty;
+    cache->depot_empty = NULL;
+
+    while (cache->empty) {
+        struct KmemSlab *slab = cache->empty;
+        slab_list_del(&cache->empty, slab);
+        slab_release(cache, slab);
+    }
+    cache->nempty = 0;
+
+    spin_unlock(&cache->lock);
+
+    while (mags) {
+        struct KmemMagazine *next = mags->next;
+        kmem_cache_free(mag_cache, mags);
+        mags = next;
+    }
+
+    kmem_irq_restore(rflags);
+}
+
+void
+kmem_reap(void) {
+    /* Magazine cache goes last since reaping
+     * of other caches frees magazines */
+    for (int i = ncaches - 1; i >= 0; i--)
+        kmem_cache_reap(&caches[i]);
+}
+
+static struct KmemCache *
+kmalloc_cache(size_t size) {
+    if (size > KMALLOC_MAX_SIZE) return NULL;
+
+    int i = 0;
+    while ((KMALLOC_MIN_SIZE << i) < size) i++;
+
+    assert(kmalloc_caches[i]);
+    return kmalloc_caches[i];
+}
+
+void *
+kmalloc(size_t size) {
+    struct KmemCache *cache = kmalloc_cache(size);
+    return cache ? kmem_cache_alloc(cache) : NULL;
+}
+
+void *
+kzalloc(size_t size) {
+    void *res = kmalloc(size);
+    if (res) memset(res, 0, size);
+    return res;
+}
+
+void
+kfree(void *obj) {
+    if (!obj) return;
+
+    struct KmemSlab *slab = obj_slab(obj);
+    if (slab->magic != KMEM_SLAB_MAGIC)
+        panic("kfree: %p was not allocated with kmalloc", obj);
+
+    kmem_cache_free(slab->cache, obj);
+}
+
+static void
+kmem_check(void) {
+    static void *objs[64];
+
+    for (size_t i = 0; i < sizeof(objs) / sizeof(*objs); i++) {
+        size_t size = i * 129 + 1;
+        objs[i] = kmalloc(size);
+        assert(objs[i]);
+        assert(!((uintptr_t)objs[i] & (KMALLOC_MIN_SIZE - 1)));
+        memset(objs[i], (int)i, size);
+    }
+    for (size_t i = 0; i < sizeof(objs) / sizeof(*objs); i++) {
+        size_t size = i * 129 + 1;
+        for (size_t j = 0; j < size; j++)
+            assert(((uint8_t *)objs[i])[j] == (uint8_t)i);
+        kfree(objs[i]);
+    }
+
+    /* Recently freed objects are reused first */
+    void *obj = kmalloc(100);
+    kfree(obj);
+    assert(kmalloc(100) == obj);
+    kfree(obj);
+
+    assert(!kmalloc(KMALLOC_MAX_SIZE + 1));
+
+    kmem_reap();
+}
+
+void
+kmem_init(void) {
+    spin_initlock(&caches_lock);
+
+    mag_cache = kmem_cache_create("kmem_magazine", sizeof(struct KmemMagazine), 0, KMEM_NOMAG);
+    assert(mag_cache);
+
+    for (int i = 0; i < KMALLOC_CACHES; i++) {
+        char name[KMEM_NAME_LEN];
+        size_t size = KMALLOC_MIN_SIZE << i;
+        snprintf(name, sizeof name, "kmalloc-%zu", size);
+        kmalloc_caches[i] = kmem_cache_create(name, size, MIN(size, KMALLOC_MIN_SIZE), 0);
+        assert(kmalloc_caches[i]);
+    }
+    static_assert((KMALLOC_MIN_SIZE << (KMALLOC_CACHES - 1)) == KMALLOC_MAX_SIZE, "kmalloc caches don't cover KMALLOC_MAX_SIZE");
+
+    kmem_check();
+
+    if (trace_init) cprintf("kmem: %d caches, %dK slabs\n", ncaches, (int)(KMEM_SLAB_SIZE / KB));
+}
+
+void
+dump_kmem_stats(void) {
+    cprintf("%-16s %5s %5s %5s %7s %6s %9s %9s %4s %5s\n",
+            "cache", "size", "chunk", "slabs", "objs", "inuse", "allocs", "frees", "hit%", "fail");
+
+    for (int i = 0; i < ncaches; i++) {
+        struct KmemCache *cache = &caches[i];
+        uint64_t rflags = kmem_irq_save();
+        spin_lock(&cache->lock);
+
+        /* Objects in magazines are free for users */
+        uint32_t cached = cache->ndepot_full * KMEM_MAG_ROUNDS;
+        struct KmemCpuCache *cpu = cpu_cache(cache);
+        if (cpu->loaded) cached += cpu->loaded->rounds;
+        if (cpu->prev) cached += cpu->prev->rounds;
+
+        cprintf("%-16s %5zu %5zu %5u %7u %6u %9lu %9lu %4lu %5lu\n",
+                cache->name, cache->size, cache->chunk, cache->nslabs,
+                cache->nslabs * cache->nobjs, cache->inuse - cached,
+                (unsigned long)cache->nalloc, (unsigned long)cache->nfree,
+                (unsigned long)(cache->nalloc ? cache->nmag_hit * 100 / cache->nalloc : 0),
+                (unsigned long)cache->nfail);
+
+        spin_unlock(&cache->lock);
+        kmem_irq_restore(rflags);
+    }
+}
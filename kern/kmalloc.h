@@ -0,0 +1,75 @@
+#ifndef JOS_KERN_KMALLOC_H
+#define JOS_KERN_KMALLOC_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+#define KMEM_SLAB_CLASS  4 /* Slabs are 2^4 pages */
+#define KMEM_SLAB_SIZE   (PAGE_SIZE << KMEM_SLAB_CLASS)
+#define KMEM_MAX_CACHES  32
+#define KMEM_MAG_ROUNDS  15 /* Objects in one magazine */
+#define KMEM_DEPOT_MAX   8  /* Full magazines kept in depot */
+#define KMEM_NAME_LEN    24
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE 8192
+
+/* Cache flags */
+#define KMEM_NOMAG 0x1 /* Don't use magazines, every call goes to slabs */
+
+/* Array of free objects, exchanged between
+ * CPU caches and depot as a whole */
+struct KmemMagazine {
+    struct KmemMagazine *next; /* Depot link */
+    uint32_t rounds;           /* Number of objects */
+    void *objs[KMEM_MAG_ROUNDS];
+};
+
+struct KmemCpuCache {
+    struct KmemMagazine *loaded; /* Objects are taken from here first */
+    struct KmemMagazine *prev;   /* Either full or empty */
+};
+
+struct KmemSlab;
+
+struct KmemCache {
+    char name[KMEM_NAME_LEN];
+    size_t size;    /* Requested object size */
+    size_t chunk;   /* Distance between objects, includes redzone */
+    size_t offset;  /* Offset of the first object in slab */
+    uint32_t nobjs; /* Objects per slab */
+    int flags;
+
+    struct KmemCpuCache cpu[NCPU];
+
+    struct spinlock lock; /* Protects everything below */
+    struct KmemMagazine *depot_full, *depot_empty;
+    uint32_t ndepot_full;
+    struct KmemSlab *partial, *empty; /* Full slabs are not linked */
+    uint32_t nempty;
+
+    /* Statistics */
+    uint64_t nalloc, nfree; /* kmem_cache_alloc() and kmem_cache_free() calls */
+    uint64_t nmag_hit;      /* Allocations served by CPU magazines */
+    uint64_t nfail;         /* Failed allocations */
+    uint32_t nslabs, nreleased;
+    uint32_t inuse; /* Objects taken from slabs, including ones in magazines */
+};
+
+void kmem_init(void);
+struct KmemCache *kmem_cache_create(const char *name, size_t size, size_t align, int flags);
+void *kmem_cache_alloc(struct KmemCache *cache);
+void kmem_cache_free(struct KmemCache *cache, void *obj);
+void kmem_cache_reap(struct KmemCache *cache);
+void kmem_reap(void);
+
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *obj);
+
+void dump_kmem_stats(void);
+
+#endif /* !JOS_KERN_KMALLOC_H */
@@ -14,6 +14,9 @@
 #include <kern/tsc.h>
 #include <kern/timer.h>
 #include <kern/env.h>
+#include <kern/numa.h>
+#include <kern/kmalloc.h>
+#include <kern/sched.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
 
@@ -34,6 +37,10 @@ int mon_frequency(int argc, char **argv, struct Trapframe *tf);
 int mon_memory(int argc, char **argv, struct Trapframe *tf);
 int mon_pagetable(int argc, char **argv, struct Trapframe *tf);
 int mon_virt(int argc, char **argv, struct Trapframe *tf);
+int mon_numa(int argc, char **argv, struct Trapframe *tf);
+int mon_ptstat(int argc, char **argv, struct Trapframe *tf);
+int mon_kmem(int argc, char **argv, struct Trapframe *tf);
+int mon_sched(int argc, char **argv, struct Trapframe *tf);
 
 struct Command {
     const char *name;
@@ -53,7 +60,11 @@ static struct Command commands[] = {
         {"timer_freq",  "Measures and prints out cpu frequency", mon_frequency},
         {"memory",      "Dumps memory lists of free pages",      mon_memory   },
         {"virt",        "Dumps virtual page tree",               mon_virt     },
-        {"pagetable",   "Dumps whole pml4 table recursively",    mon_pagetable}
+        {"pagetable",   "Dumps whole pml4 table recursively",    mon_pagetable},
+        {"numa",        "Prints NUMA nodes and allocation stats", mon_numa    },
+        {"ptstat",      "Prints page table pages cache stats",   mon_ptstat   },
+        {"kmem",        "Prints kernel object caches ('kmem reap' frees cached memory)", mon_kmem},
+        {"sched",       "Prints CPU share of environments",      mon_sched    }
 };
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
 
@@ -202,6 +213,31 @@ int mon_virt(int argc, char **argv, struct Trapframe *tf)
     return 0;
 }
 
+int mon_numa(int argc, char **argv, struct Trapframe *tf)
+{
+    dump_numa_info();
+    return 0;
+}
+
+int mon_ptstat(int argc, char **argv, struct Trapframe *tf)
+{
+    dump_pt_stats();
+    return 0;
+}
+
+int mon_kmem(int argc, char **argv, struct Trapframe *tf)
+{
+    if (argc > 1 && !strcmp(argv[1], "reap")) kmem_reap();
+    dump_kmem_stats();
+    return 0;
+}
+
+int mon_sched(int argc, char **argv, struct Trapframe *tf)
+{
+    sched_print_stats();
+    return 0;
+}
+
 static int
 runcmd(char *buf, struct Trapframe *tf) {
     int argc = 0;
@@ -0,0 +1,239 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/env.h>
+#include <kern/numa.h>
+#include <kern/pmap.h>
+#include <kern/timer.h>
+#include <kern/traceopt.h>
+
+/*
+ * NUMA topology as described by ACPI SRAT/SLIT.
+ *
+ * Until numa_init() is called (or if firmware does not
+ * provide SRAT) all memory is considered to belong to node 0.
+ */
+
+struct NumaNode numa_nodes[MAX_NUMA_NODES] = {
+        [0] = {.distance = {NUMA_LOCAL_DISTANCE}, .order = {0}},
+};
+int numa_node_count = 1;
+
+static struct NumaRange numa_ranges[MAX_NUMA_RANGES];
+static int numa_range_count;
+
+/* Node of the (only) CPU */
+static int cpu_node;
+
+/* Translates ACPI proximity domain to node index
+ * allocating new node if required */
+static int
+domain2node(uint32_t domain) {
+    for (int i = 0; i < numa_node_count; i++)
+        if (numa_nodes[i].domain == domain) return i;
+
+    if (numa_node_count == MAX_NUMA_NODES) {
+        cprintf("NUMA: too many proximity domains, merging domain %u into node 0\n", domain);
+        return 0;
+    }
+
+    numa_nodes[numa_node_count].domain = domain;
+    return numa_node_count++;
+}
+
+static void
+parse_srat(SRAT *srat) {
+    uint32_t apic_id;
+    cpuid(1, NULL, &apic_id, NULL, NULL);
+    apic_id >>= 24;
+
+    /* First domain described becomes node 0 */
+    numa_node_count = 0;
+
+    uint8_t *entry = srat->Entries;
+    uint8_t *end = (uint8_t *)srat + srat->h.Length;
+    for (; entry + sizeof(SRATEntryHeader) <= end; entry += ((SRATEntryHeader *)entry)->Length) {
+        SRATEntryHeader *hdr = (SRATEntryHeader *)entry;
+        if (!hdr->Length) break;
+
+        switch (hdr->Type) {
+        case SRAT_TYPE_CPU_AFFINITY: {
+            SRATCpuAffinity *cpu = (SRATCpuAffinity *)hdr;
+            if (!(cpu->Flags & SRAT_FLAG_ENABLED)) break;
+            uint32_t domain = cpu->ProximityDomainLo | cpu->ProximityDomainHi[0] << 8 |
+                              cpu->ProximityDomainHi[1] << 16 | cpu->ProximityDomainHi[2] << 24;
+            int node = domain2node(domain);
+            if (cpu->ApicId == apic_id) cpu_node = node;
+            break;
+        }
+        case SRAT_TYPE_X2APIC_AFFINITY: {
+            SRATX2ApicAffinity *cpu = (SRATX2ApicAffinity *)hdr;
+            if (!(cpu->Flags & SRAT_FLAG_ENABLED)) break;
+            int node = domain2node(cpu->ProximityDomain);
+            if (cpu->X2ApicId == apic_id) cpu_node = node;
+            break;
+        }
+        case SRAT_TYPE_MEMORY_AFFINITY: {
+            SRATMemoryAffinity *mem = (SRATMemoryAffinity *)hdr;
+            if (!(mem->Flags & SRAT_FLAG_ENABLED) || !mem->Length) break;
+            if (numa_range_count == MAX_NUMA_RANGES) {
+                cprintf("NUMA: too many memory ranges, ignoring [%08lX, %08lX]\n",
+                        (unsigned long)mem->BaseAddress, (unsigned long)(mem->BaseAddress + mem->Length - 1));
+                break;
+            }
+            struct NumaRange *range = &numa_ranges[numa_range_count++];
+            range->start = mem->BaseAddress;
+            range->end = mem->BaseAddress + mem->Length;
+            range->node = domain2node(mem->ProximityDomain);
+            break;
+        }
+        }
+    }
+
+    if (!numa_node_count) numa_node_count = 1;
+}
+
+static void
+parse_slit(SLIT *slit) {
+    /* Default to local/remote distances */
+    for (int i = 0; i < numa_node_count; i++)
+        for (int j = 0; j < numa_node_count; j++)
+            numa_nodes[i].distance[j] = i == j ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+
+    if (!slit) return;
+
+    uint64_t count = slit->LocalityCount;
+    for (int i = 0; i < numa_node_count; i++) {
+        for (int j = 0; j < numa_node_count; j++) {
+            uint64_t di = numa_nodes[i].domain, dj = numa_nodes[j].domain;
+            if (di < count && dj < count)
+                numa_nodes[i].distance[j] = slit->Entries[di * count + dj];
+        }
+    }
+}
+
+/* Sort nodes by distance so that allocator
+ * falls back to the closest node first */
+static void
+build_fallback_order(void) {
+    for (int i = 0; i < numa_node_count; i++) {
+        struct NumaNode *node = &numa_nodes[i];
+        for (int j = 0; j < numa_node_count; j++) {
+            int k = j;
+            for (; k > 0 && node->distance[node->order[k - 1]] > node->distance[j]; k--)
+                node->order[k] = node->order[k - 1];
+            node->order[k] = j;
+        }
+    }
+}
+
+/* Detect NUMA topology and redistribute
+ * free memory between per-node free lists */
+void
+numa_init(void) {
+    SRAT *srat = get_srat();
+    if (!srat) {
+        if (trace_init) cprintf("NUMA: no SRAT, assuming single node\n");
+        return;
+    }
+
+    parse_srat(srat);
+    parse_slit(numa_node_count > 1 ? get_slit() : NULL);
+    build_fallback_order();
+
+    if (trace_init) {
+        cprintf("NUMA: %d node(s), %d memory range(s), cpu on node %d\n",
+                numa_node_count, numa_range_count, cpu_node);
+    }
+
+    rebuild_free_lists();
+}
+
+int
+numa_local_node(void) {
+    return cpu_node;
+}
+
+/* Returns the node physical memory block [start, start + size)
+ * belongs to or NUMA_MIXED if it spans several nodes.
+ * Memory not described by SRAT belongs to node 0. */
+int
+numa_block_node(uintptr_t start, size_t size) {
+    if (numa_node_count == 1) return 0;
+
+    uintptr_t end = start + size;
+    int node = 0;
+    for (int i = 0; i < numa_range_count; i++) {
+        struct NumaRange *range = &numa_ranges[i];
+        if (range->start <= start && start < range->end) node = range->node;
+        /* Range boundary inside of the block */
+        if (size > PAGE_SIZE && ((start < range->start && range->start < end) ||
+                                 (start < range->end && range->end < end))) return NUMA_MIXED;
+    }
+
+    return node;
+}
+
+/* Chooses node and allowed node mask for the next
+ * allocation on behalf of env according to its memory policy
+ * (nodemask == 0 means any node might be used as a fallback) */
+void
+numa_env_policy(struct Env *env, int *node, uint32_t *nodemask) {
+    uint32_t valid = (1U << numa_node_count) - 1;
+    uint32_t allowed = env->env_memnodes & valid;
+    if (!allowed) allowed = valid;
+
+    *node = cpu_node;
+    *nodemask = 0;
+
+    switch (env->env_mempolicy) {
+    case MPOL_INTERLEAVE:
+        for (int i = 0; i < numa_node_count; i++) {
+            int next = (env->env_mem_next + i) % numa_node_count;
+            if (allowed & (1U << next)) {
+                *node = next;
+                env->env_mem_next = next + 1;
+                break;
+            }
+        }
+        break;
+    case MPOL_BIND:
+        for (int i = 0; i < numa_node_count; i++) {
+            int next = numa_nodes[cpu_node].order[i];
+            if (allowed & (1U << next)) {
+                *node = next;
+                break;
+            }
+        }
+        *nodemask = allowed;
+        break;
+    case MPOL_LOCAL:
+    default:
+        break;
+    }
+}
+
+void
+dump_numa_info(void) {
+    for (int i = 0; i < numa_node_count; i++) {
+        struct NumaNode *node = &numa_nodes[i];
+        cprintf("node %d (domain %u)%s: free %zuK, allocated %luK, hits %lu, misses %lu\n",
+                i, node->domain, i == cpu_node ? " [local]" : "",
+                (size_t)(node_free_memory(i) / KB), (unsigned long)(node->alloc_pages * PAGE_SIZE / KB),
+                (unsigned long)node->alloc_hits, (unsigned long)node->alloc_misses);
+
+        for (int j = 0; j < numa_range_count; j++) {
+            if (numa_ranges[j].node == i)
+                cprintf("    memory [%08lX, %08lX]\n", numa_ranges[j].start, numa_ranges[j].end - 1);
+        }
+
+        cprintf("    distances:");
+        for (int j = 0; j < numa_node_count; j++)
+            cprintf(" %u", node->distance[j]);
+        cprintf("\n");
+    }
+}
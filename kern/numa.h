@@ -0,0 +1,48 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_NUMA_H
+#define JOS_KERN_NUMA_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+#define MAX_NUMA_NODES  8
+#define MAX_NUMA_RANGES 32
+
+/* Returned by numa_block_node() for memory
+ * blocks that span several nodes */
+#define NUMA_MIXED (-1)
+
+/* Default SLIT distances */
+#define NUMA_LOCAL_DISTANCE  10
+#define NUMA_REMOTE_DISTANCE 20
+
+struct NumaRange {
+    uintptr_t start, end; /* Physical memory range [start, end) */
+    int node;
+};
+
+struct NumaNode {
+    uint32_t domain;                  /* ACPI proximity domain */
+    uint8_t distance[MAX_NUMA_NODES]; /* Relative distances to other nodes */
+    int order[MAX_NUMA_NODES];        /* Nodes sorted by distance from this one */
+
+    /* Allocation statistics */
+    uint64_t alloc_pages;   /* 4K pages allocated from this node */
+    uint64_t alloc_hits;    /* Allocations that landed on preferred node */
+    uint64_t alloc_misses;  /* Allocations that had to fall back to this node */
+};
+
+extern struct NumaNode numa_nodes[MAX_NUMA_NODES];
+extern int numa_node_count;
+
+void numa_init(void);
+int numa_local_node(void);
+int numa_block_node(uintptr_t start, size_t size);
+void numa_env_policy(struct Env *env, int *node, uint32_t *nodemask);
+void dump_numa_info(void);
+
+#endif /* !JOS_KERN_NUMA_H */
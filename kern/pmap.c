@@ -9,7 +9,9 @@
 
 #include <kern/env.h>
 #include <kern/kclock.h>
+#include <kern/numa.h>
 #include <kern/pmap.h>
+#include <kern/snapshot.h>
 #include <kern/traceopt.h>
 #include <kern/trap.h>
 
@@ -21,8 +23,8 @@
  * by struct Page
  */
 
-/* for O(1) page allocation */
-static struct List free_classes[MAX_CLASS];
+/* for O(1) page allocation (one set of lists per NUMA node) */
+static struct List free_classes[MAX_NUMA_NODES][MAX_CLASS];
 /* List of descriptor pools */
 static struct PagePool *first_pool;
 /* List of free descriptors */
@@ -116,6 +118,13 @@ list_del(struct List *list) {
 
 static struct Page *alloc_page(int class, int flags);
 
+/* Free list of given NUMA node page belongs to
+ * (pages spanning several nodes are kept on node 0) */
+inline static struct List *
+free_list(struct Page *page) {
+    return &free_classes[page->node == NUMA_MIXED ? 0 : page->node][page->class];
+}
+
 void
 ensure_free_desc(size_t count) {
     if (free_desc_count < count) {
@@ -220,6 +229,10 @@ alloc_child(struct Page *parent, bool right) {
         parent->left = new;
     }
 
+    /* Only blocks spanning several nodes have children on different ones */
+    new->node = parent->node != NUMA_MIXED ? parent->node :
+                numa_block_node(page2pa(new), CLASS_SIZE(new->class));
+
     return new;
 }
 
@@ -249,7 +262,7 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
                 struct Page *other = !right ? node->right : node->left;
                 assert(other->state == ALLOCATABLE_NODE);
                 list_del((struct List *)node);
-                list_append(&free_classes[node->class - 1], (struct List *)other);
+                list_append(free_list(other), (struct List *)other);
             }
 
             if (type != PARTIAL_NODE && node->state != type)
@@ -274,7 +287,7 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
 
         /* We cannot change RESERVED_NODE memory to ALLOCATABLE_NODE */
         if (type != PARTIAL_NODE && node->state != RESERVED_NODE) node->state = type;
-        if (node->state == ALLOCATABLE_NODE) list_append(&free_classes[node->class], (struct List *)node);
+        if (node->state == ALLOCATABLE_NODE) list_append(free_list(node), (struct List *)node);
 
         if (trace_memory) cprintf("Attaching page (%x) at %p class=%d\n", node->state, (void *)page2pa(node), (int)node->class);
     }
@@ -322,9 +335,11 @@ page_unref(struct Page *page) {
         while (page != &root) {
             struct Page *par = page->parent;
             assert_physical(par);
+            /* Pages of different NUMA nodes are never merged */
             if (par->state == page->state &&
                 PAGE_IS_FREE(par->left) &&
-                PAGE_IS_FREE(par->right)) {
+                PAGE_IS_FREE(par->right) &&
+                par->node != NUMA_MIXED) {
                 free_descriptor(par->left);
                 par->left = NULL;
 
@@ -333,7 +348,7 @@ page_unref(struct Page *page) {
 
                 if (par->state == ALLOCATABLE_NODE) {
                     assert(list_empty((struct List *)par));
-                    list_append(&free_classes[par->class], (struct List *)par);
+                    list_append(free_list(par), (struct List *)par);
                 }
                 page = par;
             } else
@@ -341,7 +356,7 @@ page_unref(struct Page *page) {
         }
         list_del((struct List *)page);
         if (page->state == ALLOCATABLE_NODE)
-            list_append(&free_classes[page->class], (struct List *)page);
+            list_append(free_list(page), (struct List *)page);
 
 #if SANITIZE_SHADOW_BASE
         if (current_space) {
@@ -517,17 +532,155 @@ unmap_page_remove(struct Page *node) {
     free_descriptor(node);
 }
 
+/*
+ * Page table pages cache.
+ *
+ * Page table pages are never returned to the buddy allocator
+ * right away, instead they are kept (still referenced) in a small
+ * cache and reused by alloc_pt(). Since remove_pt() clears every
+ * entry it visits, freed page tables are already zeroed and don't
+ * need a memset on reuse.
+ *
+ * To avoid scanning all 512 entries of sparse page tables
+ * a high-water mark of used entries is tracked for every
+ * page table page (in PT_HWM_GRANULE entries units):
+ *     0 -- unknown (page was allocated before tracking was enabled)
+ *     n -- only entries [0, (n - 1) * PT_HWM_GRANULE) might be used
+ */
+
+#define PT_CACHE_SIZE  64
+#define PT_HWM_GRANULE 8
+
+static physaddr_t pt_cache[PT_CACHE_SIZE];
+static size_t pt_cache_count;
+
+/* High-water marks indexed by page frame number */
+static uint8_t *pt_hwm;
+static size_t pt_hwm_count;
+
+static struct {
+    uint64_t allocs;      /* Page table pages allocated */
+    uint64_t frees;       /* Page table pages freed */
+    uint64_t cache_hits;  /* Allocations served from cache */
+    uint64_t cache_puts;  /* Frees that went to cache */
+    uint64_t scanned;     /* Entries scanned while removing page tables */
+} pt_stats;
+
+/* Address space teardown statistics */
+static struct {
+    uint64_t steps;      /* Number of release steps */
+    uint64_t releases;   /* Address spaces released completely */
+    uint64_t max_cycles; /* Longest single step */
+} release_stats;
+
+/* Number of possibly used entries of page table */
+inline static size_t
+pt_used_entries(pte_t *pt) {
+    size_t pfn = PAGE_NUMBER(PADDR(pt));
+    if (!pt_hwm || pfn >= pt_hwm_count || !pt_hwm[pfn]) return PT_ENTRY_COUNT;
+    return (pt_hwm[pfn] - 1) * PT_HWM_GRANULE;
+}
+
+/* Page table entry is going to be filled */
+inline static void
+pt_mark_used(pte_t *entry) {
+    size_t pfn = PAGE_NUMBER(PADDR(entry));
+    if (!pt_hwm || pfn >= pt_hwm_count || !pt_hwm[pfn]) return;
+    uint8_t mark = PAGE_OFFSET(entry) / sizeof(pte_t) / PT_HWM_GRANULE + 2;
+    if (pt_hwm[pfn] < mark) pt_hwm[pfn] = mark;
+}
+
+inline static void
+pt_mark_empty(physaddr_t pa) {
+    size_t pfn = PAGE_NUMBER(pa);
+    if (pt_hwm && pfn < pt_hwm_count) pt_hwm[pfn] = 1;
+}
+
+/* Allocate zeroed and referenced page table page */
+static physaddr_t
+pt_page_alloc(void) {
+    pt_stats.allocs++;
+
+    if (pt_cache_count) {
+        pt_stats.cache_hits++;
+        return pt_cache[--pt_cache_count];
+    }
+
+    struct Page *page = alloc_page(0, ALLOC_BOOTMEM);
+    if (!page) return 0;
+#ifdef SANITIZE_SHADOW_BASE
+    assert(page2pa(page) + CLASS_SIZE(page->class) <= BOOT_MEM_SIZE);
+#endif
+    assert(!page->refc);
+    page_ref(page);
+
+#ifdef SANITIZE_SHADOW_BASE
+    if (current_space) platform_asan_unpoison(KADDR(page2pa(page)), CLASS_SIZE(0));
+#endif
+    memset(KADDR(page2pa(page)), 0, CLASS_SIZE(0));
+    pt_mark_empty(page2pa(page));
+
+    return page2pa(page);
+}
+
+/* Free page table page, all of its entries should be already cleared */
+static void
+pt_page_free(pte_t *pt) {
+    pt_stats.frees++;
+
+    if (pt_cache_count < PT_CACHE_SIZE) {
+        pt_stats.cache_puts++;
+        pt_mark_empty(PADDR(pt));
+        pt_cache[pt_cache_count++] = PADDR(pt);
+    } else {
+        page_unref(page_lookup(NULL, (uintptr_t)PADDR(pt), 0, PARTIAL_NODE, 0));
+    }
+}
+
+static void
+pt_cache_init(void) {
+    /* High-water marks are updated while handling page faults,
+     * so they need to be allocated eagerly (hence PROT_SHARE) */
+    pt_hwm_count = max_memory_map_addr >> PAGE_SHIFT;
+    size_t size = ROUNDUP(pt_hwm_count, PAGE_SIZE);
+
+    if (metaheaptop + size > KERN_HEAP_END) panic("Kernel heap overflow\n");
+    uint8_t *hwm = (uint8_t *)metaheaptop;
+    metaheaptop += size;
+
+    int res = map_region(&kspace, (uintptr_t)hwm, NULL, 0, size, PROT_R | PROT_W | PROT_SHARE | ALLOC_ZERO);
+    if (res < 0) panic("pt_cache_init: %i\n", res);
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_unpoison(hwm, size);
+#endif
+
+    pt_hwm = hwm;
+}
+
+void
+dump_pt_stats(void) {
+    cprintf("page tables: allocated %lu, freed %lu\n",
+            (unsigned long)pt_stats.allocs, (unsigned long)pt_stats.frees);
+    cprintf("cache: %zu/%d pages, %lu hits, %lu recycled\n", pt_cache_count, PT_CACHE_SIZE,
+            (unsigned long)pt_stats.cache_hits, (unsigned long)pt_stats.cache_puts);
+    cprintf("entries scanned on removal: %lu\n", (unsigned long)pt_stats.scanned);
+    cprintf("teardown: %lu spaces in %lu steps, longest step %lu cycles\n",
+            (unsigned long)release_stats.releases, (unsigned long)release_stats.steps,
+            (unsigned long)release_stats.max_cycles);
+}
+
 static void // TODO ??? 
 remove_pt(pte_t *pt, pte_t base, size_t step, uintptr_t i0, uintptr_t i1) {
     assert(step == 1 * GB || step == 2 * MB || step == 4 * KB || step == 512 * GB);
+    pt_stats.scanned += i1 - i0;
     for (size_t i = i0; i < i1; i++) {
         if (!(pt[i] & PTE_P)) continue;
         assert(!(pt[i] & PTE_PS) || (step == 1 * GB || step == 2 * MB));
 
         if (!(pt[i] & PTE_PS) && step > 4 * KB) {
             pte_t *pt2 = KADDR(PTE_ADDR(pt[i]));
-            remove_pt(pt2, base, step / PT_ENTRY_COUNT, 0, PT_ENTRY_COUNT);
-            page_unref(page_lookup(NULL, (uintptr_t)PADDR(pt2), 0, PARTIAL_NODE, 0));
+            remove_pt(pt2, base, step / PT_ENTRY_COUNT, 0, pt_used_entries(pt2));
+            pt_page_free(pt2);
         }
 
         pt[i] = 0;
@@ -595,7 +748,7 @@ check_physical_tree(struct Page *page) {
         assert(page->head.next && page->head.prev);
         if (!list_empty((struct List *)page)) {
             for (struct List *n = page->head.next;
-                 n != &free_classes[page->class]; n = n->next) {
+                 n != free_list(page); n = n->next) {
                 assert(n != &page->head);
             }
         }
@@ -701,22 +854,25 @@ void
 dump_memory_lists(void) {
     // LAB 6: Your code here
 
-    unsigned memory_lists_num = (unsigned) sizeof(free_classes) / sizeof(free_classes[0]); 
-
-    for (unsigned class = 0; class < memory_lists_num; class++)
+    for (int node = 0; node < numa_node_count; node++)
+    for (unsigned class = 0; class < MAX_CLASS; class++)
     {
+        struct List *list = &free_classes[node][class];
+
+        if (numa_node_count > 1)
+            cprintf("node %d ", node);
         cprintf("free_classes[%02d]: ", class);
 
-        if (list_empty(free_classes + class))
+        if (list_empty(list))
             cprintf("EMPTY \n");
         else
         {
             cprintf("\n");
 
-            struct List* cur = free_classes[class].next;
+            struct List* cur = list->next;
             unsigned ct = 0;
 
-            while (cur != free_classes + class)
+            while (cur != list)
             {
                 struct Page* page = (struct Page*) cur;
                 cprintf("\t page#%03d paddr:%p, page2pa: 0x%016lx class %02d,"
@@ -792,54 +948,14 @@ dump_page_table(pte_t *pml4) {
 inline static int
 alloc_pt(pte_t *dst) {
     if (!(*dst & PTE_P) || (*dst & PTE_PS)) {
-        struct Page *page = alloc_page(0, ALLOC_BOOTMEM);
-        if (!page) return -E_NO_MEM;
-#ifdef SANITIZE_SHADOW_BASE
-        assert(page2pa(page) + CLASS_SIZE(page->class) <= BOOT_MEM_SIZE);
-#endif
-        assert(!page->refc);
-        page_ref(page);
-        *dst = page2pa(page) | PTE_U | PTE_W | PTE_P;
-
-#ifdef SANITIZE_SHADOW_BASE
-        if (current_space) platform_asan_unpoison(KADDR(page2pa(page)), CLASS_SIZE(0));
-#endif
-        memset(KADDR(page2pa(page)), 0, CLASS_SIZE(0));
+        physaddr_t pa = pt_page_alloc();
+        if (!pa) return -E_NO_MEM;
+        pt_mark_used(dst);
+        *dst = pa | PTE_U | PTE_W | PTE_P;
     }
     return 0;
 }
 
-static void
-propagate_one_pml4(struct AddressSpace *dst, struct AddressSpace *src) {
-    /* Reference level 3 page tables */
-    for (size_t i = NUSERPML4; i < PML4_ENTRY_COUNT; i++) {
-        if (src->pml4[i] & PTE_P && i != PML4_INDEX(UVPT))
-            page_ref(page_lookup(NULL, PTE_ADDR(src->pml4[i]), 0, PARTIAL_NODE, 0));
-    }
-
-    /* Dereference old level 3 page tables */
-    for (size_t i = NUSERPML4; i < PML4_ENTRY_COUNT; i++) {
-        if (dst->pml4[i] & PTE_P && i != PML4_INDEX(UVPT))
-            page_ref(page_lookup(NULL, PTE_ADDR(dst->pml4[i]), 0, PARTIAL_NODE, 0));
-    }
-
-    pte_t uvpt = dst->pml4[PML4_INDEX(UVPT)];
-    memcpy(dst->pml4 + NUSERPML4, src->pml4 + NUSERPML4,
-           PAGE_SIZE - NUSERPML4 * sizeof(pml4e_t));
-    dst->pml4[PML4_INDEX(UVPT)] = uvpt;
-}
-
-static void
-propagate_pml4(struct AddressSpace *spc) {
-    if (!current_space) return;
-
-    if (spc != &kspace) propagate_one_pml4(&kspace, spc);
-    for (size_t i = 0; i < NENV; i++) {
-        if (envs[i].env_status != ENV_FREE && &envs[i].address_space != spc)
-            propagate_one_pml4(&envs[i].address_space, spc);
-    }
-}
-
 inline static int
 alloc_fill_pt(pte_t *dst, pte_t base, size_t step, size_t i0, size_t i1) {
     assert(i0 != i1);
@@ -860,6 +976,7 @@ alloc_fill_pt(pte_t *dst, pte_t base, size_t step, size_t i0, size_t i1) {
             dst[i] = base;
         }
     }
+    pt_mark_used(dst + i1 - 1);
 
     return 0;
 }
@@ -895,21 +1012,67 @@ memcpy_page(struct AddressSpace *dst, uintptr_t va, struct Page *page) {
     switch_address_space(old);
 }
 
+/* Invalidating more pages than this one by one
+ * is slower than flushing whole TLB */
+#define TLB_INVLPG_MAX 32
+
+/* Pending TLB invalidation range of current_space
+ * (see tlb_batch_begin()) */
+static int tlb_batch_depth;
+static uintptr_t tlb_pending_start, tlb_pending_end;
+
+static void
+tlb_flush_range(uintptr_t start, uintptr_t end) {
+    /* If we need to invalidate a lot of memory, just flush whole cache */
+    if (end - start > TLB_INVLPG_MAX * PAGE_SIZE)
+        lcr3(rcr3());
+    else {
+        while (start < end) {
+            invlpg((void *)start);
+            start += PAGE_SIZE;
+        }
+    }
+}
+
 static void
 tlb_invalidate_range(struct AddressSpace *spc, uintptr_t start, uintptr_t end) {
     if (current_space == spc || !current_space) {
-        /* If we need to invalidate a lot of memory, just flush whole cache */
-        if (start - end > 512 * GB)
-            lcr3(rcr3());
-        else {
-            while (start < end) {
-                invlpg((void *)start);
-                start += PAGE_SIZE;
-            }
+        if (!tlb_batch_depth) {
+            tlb_flush_range(start, end);
+        } else if (tlb_pending_start < tlb_pending_end) {
+            tlb_pending_start = MIN(tlb_pending_start, start);
+            tlb_pending_end = MAX(tlb_pending_end, end);
+        } else {
+            tlb_pending_start = start;
+            tlb_pending_end = end;
         }
     }
 }
 
+static void
+tlb_batch_flush(void) {
+    if (tlb_pending_start < tlb_pending_end)
+        tlb_flush_range(tlb_pending_start, tlb_pending_end);
+    tlb_pending_start = tlb_pending_end = 0;
+}
+
+/* Postpones TLB invalidation of current address space until
+ * the matching tlb_batch_end(), so that a series of mapping
+ * changes costs a single flush. Mappings of current address space
+ * must not be accessed in between, pending invalidation is also
+ * performed by switch_address_space(), which precedes every
+ * kernel access to user memory in this file. */
+void
+tlb_batch_begin(void) {
+    tlb_batch_depth++;
+}
+
+void
+tlb_batch_end(void) {
+    assert(tlb_batch_depth > 0);
+    if (!--tlb_batch_depth) tlb_batch_flush();
+}
+
 static void
 unmap_page(struct AddressSpace *spc, uintptr_t addr, int class) {
     if (trace_memory) cprintf("<%p> Unmapping [%08lX, %08lX]\n",
@@ -927,9 +1090,20 @@ unmap_page(struct AddressSpace *spc, uintptr_t addr, int class) {
     uintptr_t inval_start = addr, inval_end = end;
 
     size_t pml4i0 = PML4_INDEX(addr), pml4i1 = PML4_INDEX(end);
+    /* Fixup index if whole address space is unmapped (and should be 512) */
+    if (pml4i0 >= pml4i1) pml4i1 = PML4_ENTRY_COUNT;
     if (class >= 27) {
-        remove_pt(spc->pml4, addr, 512 * GB, pml4i0, pml4i1);
-        if (pml4i1 - 1 >= NUSERPML4) propagate_pml4(spc);
+        for (size_t i = pml4i0; i < pml4i1; i++) {
+            if (i == UVPT_INDEX || !(spc->pml4[i] & PTE_P)) continue;
+            if (i < NUSERPML4) {
+                remove_pt(spc->pml4, addr, 512 * GB, i, i + 1);
+            } else if (spc == &kspace) {
+                /* Kernel level 3 page tables are shared by
+                 * all address spaces and are never freed */
+                pdpe_t *pdp = KADDR(PTE_ADDR(spc->pml4[i]));
+                remove_pt(pdp, addr, 1 * GB, 0, pt_used_entries(pdp));
+            }
+        }
         goto finish;
     }
 
@@ -1059,17 +1233,16 @@ map_page(struct AddressSpace *spc, uintptr_t addr, struct Page *page, int flags)
     assert(!(page2pa(page) & CLASS_MASK(page->class)));
 
     size_t pml4i0 = PML4_INDEX(addr), pml4i1 = PML4_INDEX(end);
-    /* Fill PML4 range if page size is larger than 512GB */
-    if (page->class >= 27) {
-        int res = alloc_fill_pt(spc->pml4, base, 512 * GB, pml4i0, pml4i1);
-        if (pml4i1 - 1 >= NUSERPML4) propagate_pml4(spc);
-        return res;
-    }
+    /* Fill PML4 range if page size is larger than 512GB
+     * (kernel slots are always present so this never
+     *  replaces shared level 3 page tables) */
+    if (page->class >= 27) return alloc_fill_pt(spc->pml4, base, 512 * GB, pml4i0, pml4i1);
 
-    /* Allocate empty pdp if required */
+    /* Allocate empty pdp if required
+     * (can only happen for user part of address space) */
     if (!(spc->pml4[pml4i0] & PTE_P)) {
+        assert(pml4i0 < NUSERPML4);
         if (alloc_pt(spc->pml4 + pml4i0) < 0) return -E_NO_MEM;
-        if (pml4i0 >= NUSERPML4) propagate_pml4(spc);
     }
     assert(!(spc->pml4[pml4i0] & PTE_PS)); /* There's (yet) no support for 512GB pages in x86 arch */
     pdpe_t *pdp = KADDR(PTE_ADDR(spc->pml4[pml4i0]));
@@ -1155,11 +1328,15 @@ unmap_region(struct AddressSpace *dspace, uintptr_t dst, uintptr_t size) {
     }
 }
 
-/* Just allocate page, without mapping it */
+/* Just allocate page, without mapping it
+ * Page is taken from preferred NUMA node if possible,
+ * falling back to the closest nodes. If nodemask is not 0
+ * only nodes within it are used. */
 static struct Page *
-alloc_page(int class, int flags) {
+alloc_page_node(int class, int flags, int node, uint32_t nodemask) {
     struct List *li = NULL;
     struct Page *peer = NULL;
+    int pnode = node;
 
     if (flags & ALLOC_POOL) flags |= ALLOC_BOOTMEM;
 #ifndef SANITIZE_SHADOW_BASE
@@ -1168,12 +1345,18 @@ alloc_page(int class, int flags) {
 
     /* Find page that is not smaller than requested
      * (Pool memory should also be within BOOT_MEM_SIZE) */
-    for (int pclass = class; pclass < MAX_CLASS; pclass++, li = NULL) {
-        for (li = free_classes[pclass].next; li != &free_classes[pclass]; li = li->next) {
-            peer = (struct Page *)li;
-            assert(peer->state == ALLOCATABLE_NODE);
-            assert_physical(peer);
-            if (!(flags & ALLOC_BOOTMEM) || page2pa(peer) + CLASS_SIZE(class) < BOOT_MEM_SIZE) goto found;
+    for (int i = 0; i < numa_node_count; i++) {
+        pnode = numa_nodes[node].order[i];
+        if (nodemask && !(nodemask & (1U << pnode))) continue;
+
+        for (int pclass = class; pclass < MAX_CLASS; pclass++, li = NULL) {
+            struct List *list = &free_classes[pnode][pclass];
+            for (li = list->next; li != list; li = li->next) {
+                peer = (struct Page *)li;
+                assert(peer->state == ALLOCATABLE_NODE);
+                assert_physical(peer);
+                if (!(flags & ALLOC_BOOTMEM) || page2pa(peer) + CLASS_SIZE(class) < BOOT_MEM_SIZE) goto found;
+            }
         }
     }
     return NULL;
@@ -1181,6 +1364,12 @@ alloc_page(int class, int flags) {
 found:
     list_del(li);
 
+    numa_nodes[pnode].alloc_pages += CLASS_SIZE(class) / PAGE_SIZE;
+    if (pnode == node)
+        numa_nodes[pnode].alloc_hits++;
+    else
+        numa_nodes[pnode].alloc_misses++;
+
     size_t ndesc = 0;
     static bool allocating_pool;
     if (flags & ALLOC_POOL) {
@@ -1224,6 +1413,73 @@ found:
     return new;
 }
 
+static struct Page *
+alloc_page(int class, int flags) {
+    return alloc_page_node(class, flags, numa_local_node(), 0);
+}
+
+/*
+ * Moves free pages to the free lists of NUMA nodes
+ * they belong to. Pages spanning several nodes are split.
+ * Called once NUMA topology is known, before that
+ * all free pages are kept on the lists of node 0.
+ */
+/* Caches NUMA node in every node of physical memory tree */
+static void
+update_page_nodes(struct Page *page) {
+    for (; page; page = page->right) {
+        page->node = numa_block_node(page2pa(page), CLASS_SIZE(page->class));
+        update_page_nodes(page->left);
+    }
+}
+
+void
+rebuild_free_lists(void) {
+    update_page_nodes(&root);
+
+    for (int class = MAX_CLASS - 1; class >= 0; class--) {
+        struct List *list = &free_classes[0][class];
+    restart:
+        for (struct List *li = list->next; li != list; li = li->next) {
+            struct Page *page = (struct Page *)li;
+            int node = page->node;
+            if (!node) continue;
+
+            /* Descriptor pool allocation might take pages from this list */
+            if (node == NUMA_MIXED && free_desc_count < 2) {
+                ensure_free_desc(2);
+                goto restart;
+            }
+
+            list_del(li);
+            if (node == NUMA_MIXED) {
+                /* Children are free and go to the lists of smaller class */
+                struct Page *left = alloc_child(page, 0);
+                struct Page *right = alloc_child(page, 1);
+                list_append(free_list(left), (struct List *)left);
+                list_append(free_list(right), (struct List *)right);
+            } else {
+                list_append(&free_classes[node][class], li);
+            }
+            goto restart;
+        }
+    }
+
+    check_physical_tree(&root);
+}
+
+/* Total size of free memory of NUMA node */
+size_t
+node_free_memory(int node) {
+    size_t total = 0;
+    for (int class = 0; class < MAX_CLASS; class++) {
+        struct List *list = &free_classes[node][class];
+        for (struct List *li = list->next; li != list; li = li->next)
+            total += CLASS_SIZE(class);
+    }
+    return total;
+}
+
 int
 region_maxref(struct AddressSpace *spc, uintptr_t addr, size_t size) {
     uintptr_t start = ROUNDDOWN(addr, PAGE_SIZE);
@@ -1240,6 +1496,50 @@ region_maxref(struct AddressSpace *spc, uintptr_t addr, size_t size) {
     return res;
 }
 
+struct ExtentWalk {
+    uintptr_t start, end;  /* Queried range */
+    struct MapExtent *buf; /* Output buffer */
+    size_t count, n;       /* Buffer capacity and number of stored extents */
+};
+
+/* In-order walk of virtual subtree, returns false when buffer is full */
+static bool
+region_extents_rec(struct Page *node, uintptr_t base, int class, struct ExtentWalk *walk) {
+    if (!node || base >= walk->end || base + CLASS_SIZE(class) <= walk->start) return 1;
+
+    if (!node->phy) {
+        return region_extents_rec(node->left, base, class - 1, walk) &&
+               region_extents_rec(node->right, base + CLASS_SIZE(class - 1), class - 1, walk);
+    }
+
+    uintptr_t start = MAX(base, walk->start);
+    uintptr_t end = MIN(base + CLASS_SIZE(class), walk->end);
+    int prot = node->state & PROT_ALL & ~PROT_COMBINE;
+
+    /* Merge with previous extent if possible */
+    if (walk->n) {
+        struct MapExtent *last = &walk->buf[walk->n - 1];
+        if (last->start + last->size == start && last->prot == prot && last->class == class) {
+            last->size += end - start;
+            return 1;
+        }
+    }
+
+    if (walk->n == walk->count) return 0;
+    walk->buf[walk->n++] = (struct MapExtent){.start = start, .size = end - start, .prot = prot, .class = class};
+    return 1;
+}
+
+/* Stores up to count extents of mappings in [start, end) to buf.
+ * Adjacent mappings with equal protection and page class are merged.
+ * Returns number of stored extents */
+size_t
+region_extents(struct AddressSpace *spc, uintptr_t start, uintptr_t end, struct MapExtent *buf, size_t count) {
+    struct ExtentWalk walk = {.start = start, .end = end, .buf = buf, .count = count};
+    region_extents_rec(spc->root, 0, MAX_CLASS, &walk);
+    return walk.n;
+}
+
 inline static int
 addr_common_class(uintptr_t addr1, uintptr_t addr2) {
     assert(!((addr1 | addr2) & CLASS_MASK(0)));
@@ -1294,14 +1594,19 @@ map_physical_region(struct AddressSpace *dst, uintptr_t dstart, uintptr_t pstart
     return 0;
 }
 
-/* Allocate page (possibly physically discontiguous) and map it to address space */
+/* Allocate page (possibly physically discontiguous) and map it to address space
+ * (memory of env address spaces is allocated according to env NUMA policy) */
 int
 alloc_composite_page(struct AddressSpace *spc, uintptr_t addr, int class, int flags) {
     int res = -E_NO_MEM;
 
     assert(!(addr & CLASS_MASK(class)));
 
-    struct Page *page = alloc_page(class, flags);
+    int node = numa_local_node();
+    uint32_t nodemask = 0;
+    if (spc->env) numa_env_policy(spc->env, &node, &nodemask);
+
+    struct Page *page = alloc_page_node(class, flags, node, nodemask);
     if (page) {
         res = map_page(spc, addr, page, flags);
     } else if (class) {
@@ -1318,10 +1623,9 @@ alloc_composite_page(struct AddressSpace *spc, uintptr_t addr, int class, int fl
 int
 force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass) {
     int res = -E_FAULT;
-    /* FIXME We need to propagate kernel PML4E
-     * changes to every AddressSpace or just use KPTI
-     * (now it's ok since kernel does not map huge chunks of memory (>= 512GB)
-     * to higher part of address space after initiallization) */
+    /* Kernel PML4 entries are populated by init_kspace() and
+     * shared by every address space, so kernel mappings created
+     * here are visible everywhere without any propagation */
 
     static_assert(!(MAX_USER_ADDRESS & (HUGE_PAGE_SIZE * 512 * 512 - 1)), "MAX_USER_ADDRESS should be alligned on 512GiB");
 
@@ -1339,6 +1643,7 @@ force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass) {
     if (!(page->state & PROT_LAZY)) goto fault;
 
     va &= ~CLASS_MASK(page->phy->class);
+    size_t size = CLASS_SIZE(page->phy->class);
 
     if (PAGE_IS_UNIQ(page->phy)) {
         /* If we have the only reference to the page and
@@ -1358,14 +1663,16 @@ force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass) {
         page_unref(phy);
     }
 
+    /* Page is about to be modified, it needs to be reverted on snapshot restore */
+    if (!res && spc->env) snapshot_dirty(spc->env, va, size);
+
 fault:
     switch_address_space(old);
 
     if (res == -E_NO_MEM) {
-        if (spc != &kspace) {
-            struct Env *env = (void *)((uint8_t *)spc - offsetof(struct Env, address_space));
-            env_destroy(env);
-        } else
+        if (spc->env)
+            env_destroy(spc->env);
+        else if (spc == &kspace)
             panic("Out of memory\n");
     } else
         assert(!res || res == -E_FAULT);
@@ -1373,10 +1680,51 @@ fault:
     return res;
 }
 
+/* Returns physical address 'va' is mapped to in 'spc' or 0 if it
+ * is not mapped. Copy-on-write page is copied first so the address
+ * stays valid while the mapping exists. */
+physaddr_t
+user_mem_paddr(struct AddressSpace *spc, uintptr_t va) {
+    struct Page *node = page_lookup_virtual(spc->root, va, 0, LOOKUP_PRESERVE);
+    if (!node || !node->phy) return 0;
+
+    if (node->state & PROT_LAZY) {
+        if (force_alloc_page(spc, va, MAX_ALLOCATION_CLASS) < 0) return 0;
+        node = page_lookup_virtual(spc->root, va, 0, LOOKUP_PRESERVE);
+        if (!node || !node->phy) return 0;
+    }
+
+    return page2pa(node->phy) + (va & CLASS_MASK(node->phy->class));
+}
+
+/* Page is referenced only by the mapping being moved */
+static bool
+page_private(struct Page *phy) {
+    return phy->refc == 1 && (!phy->parent || !phy->parent->refc);
+}
+
+/* MAP_MOVE: source mapping is replaced by destination one, page
+ * keeps its sharing state, so it is neither copied nor marked lazy.
+ * Copy-on-write page becomes writable if nobody else maps it. */
+static int
+do_move_page(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, struct Page *phy, int oldflags, int flags) {
+    if (oldflags & PROT_LAZY && page_private(phy)) oldflags &= ~PROT_LAZY;
+
+    flags = (flags & ~(PROT_LAZY | PROT_SHARE | MAP_MOVE)) | (oldflags & (PROT_LAZY | PROT_SHARE));
+    if (~oldflags & (PROT_R | PROT_W | PROT_X) & flags) return -E_INVAL;
+    if (sspace == dspace && src == dst) return map_page(dspace, dst, phy, flags);
+
+    int res = map_page(dspace, dst, phy, flags);
+    if (!res) unmap_page(sspace, src, phy->class);
+    return res;
+}
+
 static int
 do_map_page(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, struct Page *phy, int oldflags, int flags) {
     int res;
 
+    if (flags & MAP_MOVE) return do_move_page(dspace, dst, sspace, src, phy, oldflags, flags);
+
     /* PROT_COMBINE simplifies fork implementation */
     if (flags & PROT_COMBINE) {
         if (oldflags & PROT_SHARE)
@@ -1554,30 +1902,107 @@ map_region(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspa
     return 0;
 }
 
-void
-release_address_space(struct AddressSpace *space) {
+/*
+ * Address space teardown.
+ *
+ * Address space is released incrementally in address order,
+ * every step removes a bounded number of 2MB chunks (or whole
+ * mappings if they are larger), so huge address spaces don't
+ * block interrupts for long. Everything below space->release_cursor
+ * is already unmapped. Page directories are released once the
+ * cursor leaves their 1GB region, everything left (PDP, empty
+ * tree nodes and PML4 itself) is released on the last step.
+ */
+
+/* Finds leftmost mapping in virtual subtree (of given class
+ * and base address) ending after addr. Mapping address is stored to *res */
+static struct Page *
+next_mapping(struct Page *node, uintptr_t base, int class, uintptr_t addr, uintptr_t *res) {
+    if (!node || base + CLASS_SIZE(class) <= addr) return NULL;
+    if (node->phy) {
+        *res = base;
+        return node;
+    }
+
+    struct Page *found = next_mapping(node->left, base, class - 1, addr, res);
+    if (!found) found = next_mapping(node->right, base + CLASS_SIZE(class - 1), class - 1, addr, res);
+    return found;
+}
+
+/* Release empty page directory covering va */
+static void
+release_pd(struct AddressSpace *spc, uintptr_t va) {
+    if (!(spc->pml4[PML4_INDEX(va)] & PTE_P)) return;
+    pdpe_t *pdp = KADDR(PTE_ADDR(spc->pml4[PML4_INDEX(va)]));
+    remove_pt(pdp, ROUNDDOWN(va, 1 * GB), 1 * GB, PDP_INDEX(va), PDP_INDEX(va) + 1);
+}
+
+/* Release at most budget 2MB chunks of address space.
+ * Returns true if address space is released completely */
+bool
+release_address_space_step(struct AddressSpace *space, size_t budget) {
     /* NOTE: This function should not be called for kspace */
+    assert(space != &kspace);
 
-    /* Manually unref level 3 kernel page tables */
-    for (size_t i = NUSERPML4; i < PML4_ENTRY_COUNT; i++) {
-        if (kspace.pml4[i] & PTE_P && i != UVPT_INDEX)
-            page_unref(page_lookup(NULL, PTE_ADDR(kspace.pml4[i]), 0, PARTIAL_NODE, 0));
+    uint64_t start = read_tsc();
+    bool done = 0;
+
+    for (; budget; budget--) {
+        uintptr_t cursor = space->release_cursor, addr = 0;
+        struct Page *node = next_mapping(space->root, 0, MAX_CLASS, cursor, &addr);
+
+        /* Page directory of previous 1GB region is not needed anymore */
+        if (cursor && (!node || addr - ROUNDDOWN(cursor - 1, 1 * GB) >= 1 * GB))
+            release_pd(space, cursor - 1);
+
+        if (!node) {
+            done = 1;
+            break;
+        }
+
+        /* Small mappings are removed by whole 2MB chunks
+         * together with page table covering them */
+        int class = node->phy->class;
+        if (class < 9) {
+            addr = ROUNDDOWN(addr, 2 * MB);
+            class = 9;
+        }
+
+        unmap_page(space, addr, class);
+        space->release_cursor = addr + CLASS_SIZE(class);
     }
 
-    /* Unmap all memory from the space
-     * (kernel is cheating and does not store
-     *  metadata for upper part of address space (privileged)
-     *  in tree and only in page tables for user address spaces,
-     *  so unmapping is safe) */
-    unmap_page(space, 0, MAX_CLASS);
+    if (done) {
+        /* Remove what's left of the space
+         * (kernel is cheating and does not store
+         *  metadata for upper part of address space (privileged)
+         *  in tree and only in page tables for user address spaces,
+         *  so unmapping is safe; shared kernel level 3 page tables
+         *  are skipped by unmap_page()) */
+        unmap_page(space, 0, MAX_CLASS);
+
+        /* unmap_page() replaces removed root with an empty one */
+        free_descriptor(space->root);
+
+        /* Also unmap PML4 itself since it is never deallocated by page_uname*/
+        page_unref(page_lookup(NULL, space->cr3, 0, PARTIAL_NODE, 0));
+
+        /* Zero-out metadata */
+        memset(space, 0, sizeof *space);
+        release_stats.releases++;
+    }
 
-    /* Also unmap PML4 itself since it is never deallocated by page_uname*/
-    page_unref(page_lookup(NULL, space->cr3, 0, PARTIAL_NODE, 0));
+    uint64_t cycles = read_tsc() - start;
+    release_stats.steps++;
+    if (release_stats.max_cycles < cycles) release_stats.max_cycles = cycles;
 
-    /* Zero-out metadata */
-    memset(space, 0, sizeof *space);
+    return done;
 }
 
+void
+release_address_space(struct AddressSpace *space) {
+    release_address_space_step(space, (size_t)-1);
+}
 
 /*
  * This function is used for switch address spaces
@@ -1595,7 +2020,9 @@ struct AddressSpace *
 switch_address_space(struct AddressSpace *space) {
     assert(space);
     ///LAB 7: Your code here
-    
+
+    tlb_batch_flush();
+
     if (space == current_space)
         return space;
 
@@ -1613,11 +2040,10 @@ init_address_space(struct AddressSpace *space) {
      * (remember to clean flag bits of result with PTE_ADDR) */
     // LAB 8: Your code here+
 
-    pte_t pte = 0;
-    int res = alloc_pt(&pte);
-    if (res < 0) panic("init_address_space: %i \n", res);
+    physaddr_t pa = pt_page_alloc();
+    if (!pa) return -E_NO_MEM;
 
-    space->cr3 = (uintptr_t) PTE_ADDR(pte);
+    space->cr3 = (uintptr_t) pa;
 
     /* put its kernel virtual address to space->pml4 */
     // LAB 8: Your code here+
@@ -1630,14 +2056,18 @@ init_address_space(struct AddressSpace *space) {
 
     space->root = alloc_descriptor(INTERMEDIATE_NODE);
     assert(space->root != NULL);
+    space->release_cursor = 0;
+    space->env = NULL;
 
     /* Initialize UVPT */
     // LAB 8: Your code here+
 
-    space->pml4[PML4_INDEX(UVPT)] = space->cr3 | PTE_P | PTE_U;
+    /* Kernel part of address space consists of level 3
+     * page tables shared with kspace, so it is just copied */
+    memcpy(space->pml4 + NUSERPML4, kspace.pml4 + NUSERPML4,
+           (PML4_ENTRY_COUNT - NUSERPML4) * sizeof(pml4e_t));
 
-    /* Why this call is required here and what does it do? */
-    propagate_one_pml4(space, &kspace);
+    space->pml4[PML4_INDEX(UVPT)] = space->cr3 | PTE_P | PTE_U;
     return 0;
 }
 
@@ -1761,8 +2191,9 @@ init_allocator(void) {
     metaheaptop = KERN_HEAP_START + ROUNDUP(uefi_lp->FrameBufferSize, PAGE_SIZE);
 
     /* Initiallize lists */
-    for (size_t i = 0; i < MAX_CLASS; i++)
-        list_init(&free_classes[i]);
+    for (size_t n = 0; n < MAX_NUMA_NODES; n++)
+        for (size_t i = 0; i < MAX_CLASS; i++)
+            list_init(&free_classes[n][i]);
 
     /* Initiallize first pool */
 
@@ -1804,6 +2235,20 @@ kzalloc_region(size_t size) {
     return (void *)res;
 }
 
+/* Allocates physically contiguous block of 2^class pages
+ * for kernel use, it is accessed with KADDR(page2pa(page)) */
+struct Page *
+alloc_kpage(int class) {
+    struct Page *page = alloc_page(class, ALLOC_BOOTMEM);
+    if (page) page_ref(page);
+    return page;
+}
+
+void
+free_kpage(struct Page *page) {
+    page_unref(page);
+}
+
 static uintptr_t prev_mmio;
 void *
 mmio_map_region(physaddr_t addr, size_t size) {
@@ -1842,6 +2287,14 @@ init_kspace(void) {
     memset(kspace.pml4, 0, CLASS_SIZE(0));
     kspace.pml4[PML4_INDEX(UVPT)] = kspace.cr3 | PTE_P | PTE_U;
     kspace.root = alloc_descriptor(INTERMEDIATE_NODE);
+
+    /* Pre-populate every kernel PML4 entry with permanent level 3
+     * page table so that they can be shared by all address spaces
+     * and kernel PML4 entries never change after this point */
+    for (size_t i = NUSERPML4; i < PML4_ENTRY_COUNT; i++) {
+        if (i == UVPT_INDEX) continue;
+        if (alloc_pt(kspace.pml4 + i) < 0) panic("Cannot allocate kernel page tables\n");
+    }
 }
 
 #ifdef SANITIZE_SHADOW_BASE
@@ -2075,8 +2528,11 @@ init_memory(void) {
     check_virtual_tree(kspace.root, MAX_CLASS);
     if (trace_init) cprintf("Kernel virutal memory tree is correct\n");
 
+    pt_cache_init();
+
     #ifdef SANITIZE_SHADOW_BASE
         platform_asan_unpoison((void*) (USER_STACK_TOP - USER_STACK_SIZE), USER_STACK_SIZE);
+        platform_asan_unpoison((void*) USER_TLS, USER_TLS_SIZE);
         platform_asan_unpoison((void*) (USER_EXCEPTION_STACK_TOP - USER_EXCEPTION_STACK_SIZE), USER_EXCEPTION_STACK_SIZE);
     #endif 
 }
@@ -20,6 +20,9 @@
 /* asan unpoison routine used for whitelisting regions. */
 void platform_asan_unpoison(void *, size_t);
 void platform_asan_poison(void *, size_t);
+/* Heap allocator hooks, chunk includes redzone */
+void platform_asan_malloc(void *, size_t size, size_t chunk);
+void platform_asan_free(void *, size_t chunk);
 /* not sanitized memset allows us to access "invalid" areas for extra poisoning. */
 void __nosan_memset(void *, int, size_t);
 void __nosan_memcpy(void *, void *, size_t);
@@ -47,6 +50,7 @@ void __nosan_memmove(void *, void *, size_t);
 /* map_region() source override flags */
 #define ALLOC_ZERO 0x100000 /* Allocate memory filled with 0x00 */
 #define ALLOC_ONE  0x200000 /* Allocate memory filled with 0xFF */
+#define MAP_MOVE   0x400000 /* Move source mapping instead of sharing it */
 
 /* Memory protection flags & attributes */
 #define PROT_X       0x1 /* Executable */
@@ -82,6 +86,7 @@ struct Page {
     struct List head; /* This should be first member */
     struct Page *left, *right, *parent;
     enum PageState state;
+    int node; /* NUMA node of physical memory (see numa_block_node()) */
     union {
         struct /* physical page */ {
             /* Number of references
@@ -104,18 +109,29 @@ struct PagePool {
 
 int map_region(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, uintptr_t size, int flags);
 void unmap_region(struct AddressSpace *dspace, uintptr_t dst, uintptr_t size);
+void tlb_batch_begin(void);
+void tlb_batch_end(void);
 void init_memory(void);
 void release_address_space(struct AddressSpace *space);
+bool release_address_space_step(struct AddressSpace *space, size_t budget);
 struct AddressSpace *switch_address_space(struct AddressSpace *space);
 int init_address_space(struct AddressSpace *space);
+int user_mem_check(struct Env *env, const void *va, size_t len, int perm);
+physaddr_t user_mem_paddr(struct AddressSpace *spc, uintptr_t va);
 void user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
 int region_maxref(struct AddressSpace *spc, uintptr_t addr, size_t size);
+size_t region_extents(struct AddressSpace *spc, uintptr_t start, uintptr_t end, struct MapExtent *buf, size_t count);
 int force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass);
 void dump_page_table(pte_t *pml4);
 void dump_memory_lists(void);
 void dump_virtual_tree(struct Page *node, int class);
+void rebuild_free_lists(void);
+void dump_pt_stats(void);
+size_t node_free_memory(int node);
 
 void *kzalloc_region(size_t size);
+struct Page *alloc_kpage(int class);
+void free_kpage(struct Page *page);
 
 void *mmio_map_region(physaddr_t addr, size_t size);
 void *mmio_remap_last_region(physaddr_t addr, void *oldva, size_t oldsz, size_t size);
@@ -1,20 +1,446 @@
 #include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
 #include <inc/x86.h>
 #include <kern/env.h>
+#include <kern/wait.h>
 #include <kern/monitor.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/syscall.h>
+#include <kern/timer.h>
+#include <kern/tsc.h>
 
+/*
+ * Weighted fair share scheduling.
+ *
+ * Every environment is charged for TSC cycles it consumes (on kernel
+ * entry and on context switch), its virtual runtime grows by consumed
+ * cycles scaled by SCHED_WEIGHT_DEFAULT / env_weight. Runnable envs are
+ * kept in a min-heap ordered by virtual runtime, the one with smallest
+ * virtual runtime runs next, so CPU time is shared in proportion to
+ * weights.
+ *
+ * Virtual runtime of envs is kept close to sched_min_vruntime (the
+ * smallest virtual runtime among running and runnable envs), otherwise
+ * env that slept for a long time would monopolize CPU after wakeup:
+ *  - new envs start at sched_min_vruntime;
+ *  - envs woken after sleeping in the kernel (IPC, wait, futex) are placed
+ *    up to SCHED_WAKEUP_CREDIT_US of runtime before it, so they usually run
+ *    before CPU-bound envs and preempt curenv as soon as it enters the
+ *    kernel; envs made runnable by sys_env_set_status() (e.g. after
+ *    sys_exofork()) get no credit and don't preempt.
+ *
+ * Real-time envs (see sched_set_rt()) reserve 'runtime' cycles in every
+ * 'period' that should be consumed before 'deadline' from the start of
+ * period. They always run before fair share envs, among themselves in
+ * earliest deadline first order. Admission control keeps the sum of
+ * runtime / deadline under SCHED_RT_UTIL_MAX_PCT, which is enough for
+ * EDF to meet all deadlines on a single CPU.
+ *
+ * Real-time env completes its job with sys_yield(), or is throttled
+ * when it exhausts the budget, and then waits for the next period.
+ * Budget exhaustion and period starts are caught by HPET one-shot
+ * timer (see sched_arm_timer()), periodic tick is too coarse for that.
+ */
+
+#define SCHED_WAKEUP_CREDIT_US 1000
+
+/* Fixed point utilization of real-time envs */
+#define SCHED_RT_UTIL_SHIFT 20
+#define SCHED_RT_UTIL_MAX   (((uint64_t)SCHED_RT_UTIL_MAX_PCT << SCHED_RT_UTIL_SHIFT) / 100)
 
 struct Taskstate cpu_ts;
 _Noreturn void sched_halt(void);
 
+/* Binary min-heap of runnable environments,
+ * maintained by env_set_status() */
+struct RunQueue {
+    struct Env *heap[NENV];
+    uint32_t size;
+    bool (*before)(struct Env *a, struct Env *b);
+};
+
+static bool fair_before(struct Env *a, struct Env *b);
+static bool rt_before(struct Env *a, struct Env *b);
+static bool throttled_before(struct Env *a, struct Env *b);
+
+static struct RunQueue sched_fair = {.before = fair_before};
+static struct RunQueue sched_rt = {.before = rt_before};
+/* Real-time envs waiting for their next period */
+static struct RunQueue sched_throttled = {.before = throttled_before};
+static uint64_t sched_seq;
+
+static uint64_t sched_min_vruntime;
+static uint64_t sched_wakeup_credit; /* In TSC cycles */
+static uint64_t sched_tsc_freq;
+/* Woken env should preempt curenv */
+static bool sched_resched;
+
+static uint64_t sched_rt_util; /* Sum of runtime / deadline of real-time envs */
+static uint32_t sched_rt_nenvs;
+static uint64_t sched_timer_at; /* TSC when one-shot timer fires */
+
+static bool
+fair_before(struct Env *a, struct Env *b) {
+    return a->env_vruntime < b->env_vruntime ||
+           (a->env_vruntime == b->env_vruntime && a->env_rq_seq < b->env_rq_seq);
+}
+
+static bool
+rt_before(struct Env *a, struct Env *b) {
+    return a->env_rt_abs_deadline < b->env_rt_abs_deadline ||
+           (a->env_rt_abs_deadline == b->env_rt_abs_deadline && a->env_rq_seq < b->env_rq_seq);
+}
+
+static bool
+throttled_before(struct Env *a, struct Env *b) {
+    return a->env_rt_release < b->env_rt_release ||
+           (a->env_rt_release == b->env_rt_release && a->env_rq_seq < b->env_rq_seq);
+}
+
+static bool
+rt_active(struct Env *env) {
+    return env->env_rt_period && !env->env_rt_throttled;
+}
+
+/* Whether runnable env should run before running env 'cur' */
+static bool
+sched_before(struct Env *env, struct Env *cur) {
+    if (rt_active(env) != rt_active(cur)) return rt_active(env);
+    return rt_active(env) ? rt_before(env, cur) : fair_before(env, cur);
+}
+
+static struct RunQueue *
+runq_of(struct Env *env) {
+    if (!env->env_rt_period) return &sched_fair;
+    return env->env_rt_throttled ? &sched_throttled : &sched_rt;
+}
+
+static struct Env *
+runq_top(struct RunQueue *queue) {
+    return queue->size ? queue->heap[0] : NULL;
+}
+
+static void
+runq_set(struct RunQueue *queue, uint32_t i, struct Env *env) {
+    queue->heap[i] = env;
+    env->env_rq_index = i;
+}
+
+static void
+runq_sift_up(struct RunQueue *queue, uint32_t i) {
+    struct Env *env = queue->heap[i];
+    for (; i && queue->before(env, queue->heap[(i - 1) / 2]); i = (i - 1) / 2)
+        runq_set(queue, i, queue->heap[(i - 1) / 2]);
+    runq_set(queue, i, env);
+}
+
+static void
+runq_sift_down(struct RunQueue *queue, uint32_t i) {
+    struct Env *env = queue->heap[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= queue->size) break;
+        if (child + 1 < queue->size && queue->before(queue->heap[child + 1], queue->heap[child])) child++;
+        if (!queue->before(queue->heap[child], env)) break;
+        runq_set(queue, i, queue->heap[child]);
+        i = child;
+    }
+    runq_set(queue, i, env);
+}
+
+static void
+runq_insert(struct Env *env) {
+    struct RunQueue *queue = runq_of(env);
+    assert(queue->size < NENV);
+    env->env_rq_seq = sched_seq++;
+    runq_set(queue, queue->size++, env);
+    runq_sift_up(queue, env->env_rq_index);
+}
+
+static void
+runq_remove(struct Env *env) {
+    struct RunQueue *queue = runq_of(env);
+    uint32_t i = env->env_rq_index;
+    assert(i < queue->size && queue->heap[i] == env);
+
+    struct Env *last = queue->heap[--queue->size];
+    if (last == env) return;
+
+    runq_set(queue, i, last);
+    runq_sift_up(queue, i);
+    runq_sift_down(queue, last->env_rq_index);
+}
+
+/* Next env to run: real-time one with the earliest
+ * deadline or fair share one with the smallest virtual runtime */
+static struct Env *
+sched_pick(void) {
+    struct Env *env = runq_top(&sched_rt);
+    return env ? env : runq_top(&sched_fair);
+}
+
+static uint64_t
+us2tsc(uint64_t us) {
+    return (uint64_t)((unsigned __int128)us * sched_tsc_freq / 1000000);
+}
+
+static uint64_t
+tsc2us(uint64_t tsc) {
+    return (uint64_t)((unsigned __int128)tsc * 1000000 / sched_tsc_freq);
+}
+
+static uint64_t
+rt_util(uint64_t runtime, uint64_t deadline) {
+    return deadline ? (runtime << SCHED_RT_UTIL_SHIFT) / deadline : 0;
+}
+
+/* Starts new job of real-time env at 'release' */
+static void
+rt_new_job(struct Env *env, uint64_t release) {
+    env->env_rt_release = release;
+    env->env_rt_abs_deadline = release + env->env_rt_deadline;
+    env->env_rt_budget = env->env_rt_runtime;
+    env->env_rt_throttled = 0;
+}
+
+/* Suspends real-time env until its next period */
+static void
+rt_throttle(struct Env *env, uint64_t now) {
+    env->env_rt_release = MAX(env->env_rt_release + env->env_rt_period, now);
+    env->env_rt_budget = 0;
+    env->env_rt_throttled = 1;
+}
+
+static void
+rt_miss(struct Env *env, uint64_t now) {
+    env->env_rt_stats.misses++;
+    if (now > env->env_rt_abs_deadline)
+        env->env_rt_stats.max_late_us = MAX(env->env_rt_stats.max_late_us, tsc2us(now - env->env_rt_abs_deadline));
+}
+
+/* Moves throttled envs which next period has started to the run queue */
+static void
+sched_rt_release(uint64_t now) {
+    struct Env *env;
+    while ((env = runq_top(&sched_throttled)) && env->env_rt_release <= now) {
+        runq_remove(env);
+        rt_new_job(env, env->env_rt_release);
+        runq_insert(env);
+
+        if (curenv && curenv->env_status == ENV_RUNNING && sched_before(env, curenv)) sched_resched = 1;
+    }
+}
+
+static void
+sched_update_min(void) {
+    struct Env *min = runq_top(&sched_fair);
+    if (curenv && curenv->env_status == ENV_RUNNING && !curenv->env_rt_period &&
+        (!min || curenv->env_vruntime < min->env_vruntime)) min = curenv;
+
+    if (min && min->env_vruntime > sched_min_vruntime)
+        sched_min_vruntime = min->env_vruntime;
+}
+
+void
+sched_init(void) {
+    sched_tsc_freq = tsc_calibrate();
+    sched_wakeup_credit = sched_tsc_freq / 1000000 * SCHED_WAKEUP_CREDIT_US;
+}
+
+/* Charges env for TSC cycles since previous call
+ * (or since it was switched to by env_run()) */
+void
+sched_account(struct Env *env) {
+    uint64_t now = read_tsc();
+    uint64_t delta = now - env->env_sched_stamp;
+    env->env_sched_stamp = now;
+
+    bool queued = env->env_status == ENV_RUNNABLE;
+    if (queued) runq_remove(env);
+
+    env->env_runtime += delta;
+    if (!env->env_rt_period) {
+        env->env_vruntime += (uint64_t)((unsigned __int128)delta * SCHED_WEIGHT_DEFAULT / env->env_weight);
+    } else if (!env->env_rt_throttled) {
+        if (delta < env->env_rt_budget) {
+            env->env_rt_budget -= delta;
+        } else {
+            /* Budget is exhausted, the job can't
+             * complete before its deadline */
+            env->env_rt_stats.overruns++;
+            rt_miss(env, now);
+            rt_throttle(env, now);
+            if (env == curenv) sched_resched = 1;
+        }
+    }
+
+    if (queued) runq_insert(env);
+    sched_update_min();
+}
+
+/* Real-time env completed its job for current period */
+void
+sched_rt_yield(struct Env *env) {
+    if (!rt_active(env)) return;
+
+    bool queued = env->env_status == ENV_RUNNABLE;
+    if (queued) runq_remove(env);
+
+    uint64_t now = read_tsc();
+    env->env_rt_stats.jobs++;
+    if (now > env->env_rt_abs_deadline) rt_miss(env, now);
+    rt_throttle(env, now);
+
+    if (queued) runq_insert(env);
+}
+
+/* Puts env into real-time class with 'runtime' microseconds
+ * of CPU time every 'period' microseconds to be consumed before
+ * 'deadline' (the same as period if 0) from the start of period.
+ * Zero runtime returns env to the fair share class.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_INVAL if parameters are not in SCHED_RT_RUNTIME_MIN_US <=
+ *      runtime <= deadline <= period <= SCHED_RT_PERIOD_MAX_US.
+ *  -E_NO_CPU if total utilization would exceed SCHED_RT_UTIL_MAX_PCT. */
+int
+sched_set_rt(struct Env *env, uint64_t runtime, uint64_t period, uint64_t deadline) {
+    if (!deadline) deadline = period;
+    if (runtime && (runtime < SCHED_RT_RUNTIME_MIN_US || runtime > deadline ||
+                    deadline > period || period > SCHED_RT_PERIOD_MAX_US)) return -E_INVAL;
+
+    runtime = us2tsc(runtime);
+    deadline = us2tsc(deadline);
+    period = us2tsc(period);
+
+    /* Utilization of env is recalculated from its stored
+     * parameters, so that the sum is exactly restored on exit */
+    uint64_t util = sched_rt_util - rt_util(env->env_rt_runtime, env->env_rt_deadline) + rt_util(runtime, deadline);
+    if (util > SCHED_RT_UTIL_MAX) return -E_NO_CPU;
+
+    bool queued = env->env_status == ENV_RUNNABLE;
+    if (queued) runq_remove(env);
+
+    sched_rt_nenvs += (runtime != 0) - (env->env_rt_period != 0);
+    sched_rt_util = util;
+    env->env_rt_runtime = runtime;
+    env->env_rt_period = period;
+    env->env_rt_deadline = deadline;
+
+    if (runtime) {
+        rt_new_job(env, read_tsc());
+    } else {
+        env->env_rt_throttled = 0;
+        sched_update_min();
+        env->env_vruntime = MAX(env->env_vruntime, sched_min_vruntime);
+    }
+
+    if (queued) runq_insert(env);
+
+    /* Pick the next env again when the class of curenv
+     * is changed or new real-time env becomes runnable */
+    if (env == curenv || (queued && curenv && sched_before(env, curenv))) sched_resched = 1;
+    return 0;
+}
+
+/* Adds env that was in 'prev' status to the run queue */
+void
+sched_enqueue(struct Env *env, unsigned prev) {
+    sched_update_min();
+
+    if (env->env_rt_period) {
+        uint64_t now = read_tsc();
+        /* Woken env keeps current deadline only if the rest of its
+         * budget fits before it at reserved bandwidth (constant
+         * bandwidth server rule), otherwise new job starts now */
+        if (prev == ENV_NOT_RUNNABLE && !env->env_rt_throttled &&
+            (env->env_rt_abs_deadline <= now ||
+             (unsigned __int128)env->env_rt_budget * env->env_rt_deadline >
+                     (unsigned __int128)(env->env_rt_abs_deadline - now) * env->env_rt_runtime))
+            rt_new_job(env, now);
+    } else if (prev == ENV_FREE) {
+        env->env_vruntime = sched_min_vruntime;
+    } else if (prev == ENV_NOT_RUNNABLE) {
+        /* Only envs that slept in env_sleep() get wakeup credit, env
+         * started after sys_exofork() or resumed by sys_env_set_status()
+         * continues where it was, so forking doesn't give extra CPU time */
+        uint64_t credit = env->env_sched_blocked ? MIN(sched_min_vruntime, sched_wakeup_credit) : 0;
+        env->env_vruntime = MAX(env->env_vruntime, sched_min_vruntime - credit);
+    }
+
+    runq_insert(env);
+
+    if (prev == ENV_NOT_RUNNABLE && (env->env_sched_blocked || env->env_rt_period) && curenv &&
+        curenv != env && curenv->env_status == ENV_RUNNING && sched_before(env, curenv)) sched_resched = 1;
+}
+
+void
+sched_dequeue(struct Env *env) {
+    runq_remove(env);
+}
+
+/* Program one-shot timer for the nearest event of real-time
+ * class: budget exhaustion of 'env' which is about to run
+ * or start of the next period of throttled envs */
+void
+sched_arm_timer(struct Env *env) {
+    if (!sched_rt_nenvs) return;
+
+    uint64_t now = read_tsc(), at = UINT64_MAX;
+    if (env && rt_active(env)) at = now + env->env_rt_budget;
+    struct Env *next = runq_top(&sched_throttled);
+    if (next) at = MIN(at, next->env_rt_release);
+    if (at == UINT64_MAX) return;
+
+    /* Pending timer fires early enough */
+    if (sched_timer_at > now && sched_timer_at <= at) return;
+
+    /* Round up, early interrupt would only arm the timer again */
+    uint64_t delta = at > now ? at - now : 0;
+    uint64_t ns = (uint64_t)(((unsigned __int128)delta * 1000000000 + sched_tsc_freq - 1) / sched_tsc_freq);
+    if (hpet_oneshot_tim1(ns)) sched_timer_at = at;
+}
+
+/* Some env was woken up and should run before curenv */
+bool
+sched_preempt_pending(void) {
+    return sched_resched;
+}
+
+/* Execute batched system calls of the descheduled environment
+ * while its address space is still active */
+static void
+sched_deschedule(void) {
+    if (curenv && curenv->env_ring && current_space == &curenv->address_space &&
+        curenv->env_status != ENV_DYING) sysring_drain(curenv);
+}
+
+/* Switch from blocked curenv directly to 'env' without
+ * searching for the next runnable environment
+ * (used by synchronous IPC to donate the rest of time slice) */
+_Noreturn void
+sched_handoff(struct Env *env) {
+    sched_deschedule();
+    sched_resched = 0;
+
+    /* Real-time envs with earlier deadlines are not bypassed */
+    struct Env *rt = runq_top(&sched_rt);
+    if (env->env_status == ENV_RUNNABLE && !env->env_rt_throttled &&
+        (!rt || !sched_before(rt, env))) env_run(env);
+    sched_yield();
+}
+
 /* Choose a user environment to run and run it */
 _Noreturn void
 sched_yield(void) {
-    /* Implement simple round-robin scheduling.
-     *
-     * Search through 'envs' for an ENV_RUNNABLE environment in
-     * circular fashion starting just after the env was
-     * last running.  Switch to the first such environment found.
+    /* Run the real-time environment with the earliest deadline,
+     * or, if there is none, fair share environment with the
+     * smallest virtual runtime. Even if curenv has smaller one,
+     * it gives up the CPU since it yields (use sched_tick() for
+     * preemption). Real-time curenv gives up the CPU only to
+     * earlier deadlines.
      *
      * If no envs are runnable, but the environment previously
      * running is still ENV_RUNNING, it's okay to
@@ -24,76 +450,134 @@ sched_yield(void) {
      * simply drop through to the code
      * below to halt the cpu */
 
-    // LAB 3: Your code here:
+    sched_deschedule();
+    sched_resched = 0;
 
-    if (curenv == NULL)
-        env_run(&envs[0]);
+    /* Real-time env that exhausted its budget
+     * waits for the next period */
+    if (curenv && curenv->env_status == ENV_RUNNING && curenv->env_rt_throttled)
+        env_set_status(curenv, ENV_RUNNABLE);
+    sched_rt_release(read_tsc());
 
-    const struct Env* end = (const struct Env*) (envs + NENV);    
-    struct Env* cur = curenv + 1;
+    struct Env *next = sched_pick();
+    if (next && !(curenv && curenv->env_status == ENV_RUNNING &&
+                  rt_active(curenv) && !sched_before(next, curenv)))
+        env_run(next);
 
-    while(cur != curenv)
-    {
-        if (cur == end) 
-        {
-            cur =  envs;
-            continue;
-        }
+    if (curenv && curenv->env_status == ENV_RUNNING)
+        env_run(curenv);
 
-        if (cur->env_status == ENV_FREE)
-        {
-            cur++;
-            continue;
-        }
+    /* No runnable environments,
+     * so just halt the cpu */
+    cprintf("Halt\n");
+    sched_halt();
+}
 
-        if (cur->env_status == ENV_RUNNABLE)
-            env_run(cur);
+/* Called on timer interrupt: curenv keeps running unless some
+ * runnable env has earlier deadline or smaller virtual runtime */
+_Noreturn void
+sched_tick(void) {
+    sched_rt_release(read_tsc());
 
-        if (cur->env_status == ENV_DYING)
-            env_free(cur);
+    struct Env *next = sched_pick();
+    if (curenv && curenv->env_status == ENV_RUNNING && !sched_resched &&
+        (!next || !sched_before(next, curenv)))
+        env_run(curenv);
 
-        if (cur->env_status == ENV_RUNNING)
-            panic("sched_yield: two envs with ENV_RUNNING env_status");
+    sched_yield();
+}
 
-        cur++;
+/* Prints CPU share of environments since the previous call
+ * (or since they were created) and how far ahead of
+ * the smallest virtual runtime they are */
+void
+sched_print_stats(void) {
+    uint64_t total = 0, total_weight = 0;
+    for (size_t i = 0; i < NENV; i++) {
+        struct Env *env = &envs[i];
+        if (env->env_status == ENV_FREE) continue;
+        total += env->env_runtime - env->env_runtime_mark;
+        if (env->env_status == ENV_RUNNABLE || env->env_status == ENV_RUNNING) total_weight += env->env_weight;
     }
 
-    if (cur->env_status != ENV_FREE)
-        env_run(curenv);
+    static const char *state[] = {"free", "dying", "runnable", "running", "blocked"};
+    cprintf("env      status   weight   runtime(ms) cpu%%   lag(us)\n");
+    for (size_t i = 0; i < NENV; i++) {
+        struct Env *env = &envs[i];
+        if (env->env_status == ENV_FREE) continue;
 
-    /* No runnable environments,
-     * so just halt the cpu */
-    cprintf("Halt\n");
-    sched_halt();
+        uint64_t delta = env->env_runtime - env->env_runtime_mark;
+        env->env_runtime_mark = env->env_runtime;
+        cprintf("%08x %-8s %6u %13lu %4lu %10lu\n", env->env_id, state[env->env_status], env->env_weight,
+                (unsigned long)(env->env_runtime / (sched_tsc_freq / 1000)),
+                (unsigned long)(total ? delta * 100 / total : 0),
+                (unsigned long)((env->env_vruntime - MIN(env->env_vruntime, sched_min_vruntime)) / (sched_tsc_freq / 1000000)));
+    }
+    cprintf("runnable %u, total weight %lu\n", sched_fair.size + sched_rt.size + (curenv && curenv->env_status == ENV_RUNNING),
+            (unsigned long)total_weight);
+
+    if (!sched_rt_nenvs) return;
+    cprintf("real-time utilization %lu%%\n", (unsigned long)((sched_rt_util * 100) >> SCHED_RT_UTIL_SHIFT));
+    cprintf("env      runtime(us) period(us) deadline(us) jobs       misses   overruns max late(us)\n");
+    for (size_t i = 0; i < NENV; i++) {
+        struct Env *env = &envs[i];
+        if (env->env_status == ENV_FREE || !env->env_rt_period) continue;
+
+        struct EnvRtStats *stats = &env->env_rt_stats;
+        cprintf("%08x %11lu %10lu %12lu %10lu %8lu %8lu %12lu\n", env->env_id,
+                (unsigned long)tsc2us(env->env_rt_runtime), (unsigned long)tsc2us(env->env_rt_period),
+                (unsigned long)tsc2us(env->env_rt_deadline), (unsigned long)stats->jobs,
+                (unsigned long)stats->misses, (unsigned long)stats->overruns, (unsigned long)stats->max_late_us);
+    }
 }
 
-/* Halt this CPU when there is nothing to do. Wait until the
- * timer interrupt wakes it up. This function never returns */
-_Noreturn void
-sched_halt(void) {
+/* Idle loop of sched_halt(), runs on the reset kernel stack, so
+ * interrupts taken here don't pile up frames of the trap that led
+ * to sched_halt(): scheduling from them resets the stack again */
+static _Noreturn void
+sched_idle(void) {
+    /* Use idle time to release memory of dying environments.
+     * Interrupts are allowed between steps so that
+     * newly runnable environments are not delayed */
+    while (env_reclaim())
+        asm volatile("sti\nnop\ncli" ::: "memory");
+
+    /* Wake up at the start of the next real-time period */
+    sched_arm_timer(NULL);
 
     /* For debugging and testing purposes, if there are no runnable
      * environments in the system, then drop into the kernel monitor */
-    int i;
-    for (i = 0; i < NENV; i++)
-        if (envs[i].env_status == ENV_RUNNABLE ||
-            envs[i].env_status == ENV_RUNNING) break;
-    if (i == NENV) {
+    /* Environments waiting with timeout or for console input
+     * will be woken up by timer */
+    if (!sched_fair.size && !sched_rt.size && !sched_throttled.size && !wait_tick_pending()) {
         cprintf("No runnable environments in the system!\n");
         for (;;) monitor(NULL);
     }
 
+    /* Enable interrupts and then halt */
+    asm volatile("sti\nhlt\n");
+
+    /* Unreachable */
+    for (;;)
+        ;
+}
+
+/* Halt this CPU when there is nothing to do. Wait until the
+ * timer interrupt wakes it up. This function never returns */
+_Noreturn void
+sched_halt(void) {
     /* Mark that no environment is running on CPU */
+    if (curenv) sched_account(curenv);
     curenv = NULL;
 
-    /* Reset stack pointer, enable interrupts and then halt */
+    /* Reset stack pointer and continue in sched_idle() */
     asm volatile(
             "movq $0, %%rbp\n"
             "movq %0, %%rsp\n"
             "pushq $0\n"
             "pushq $0\n"
-            "sti\n"
-            "hlt\n" ::"a"(cpu_ts.ts_rsp0));
+            "call *%1\n" ::"a"(cpu_ts.ts_rsp0),
+            "c"(sched_idle));
 
     /* Unreachable */
     for (;;)
@@ -6,6 +6,19 @@
 #error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/env.h>
+
+void sched_init(void);
+void sched_account(struct Env *env);
+void sched_enqueue(struct Env *env, unsigned prev);
+void sched_dequeue(struct Env *env);
+void sched_arm_timer(struct Env *env);
+int sched_set_rt(struct Env *env, uint64_t runtime, uint64_t period, uint64_t deadline);
+void sched_rt_yield(struct Env *env);
+bool sched_preempt_pending(void);
+void sched_print_stats(void);
 _Noreturn void sched_yield(void);
+_Noreturn void sched_tick(void);
+_Noreturn void sched_handoff(struct Env *env);
 
 #endif /* !JOS_KERN_SCHED_H */
@@ -0,0 +1,136 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/string.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/snapshot.h>
+#include <kern/traceopt.h>
+
+/*
+ * Env snapshots.
+ *
+ * Snapshot consists of env's trapframe and a copy-on-write image
+ * of its user address space (mapped just like fork() does).
+ * Once snapshot is taken, every private page of env is lazy, so
+ * the first write to it makes a private copy in force_alloc_page(),
+ * which records the page in the dirty log. Regions mapped and unmapped
+ * by system calls are logged too. Restoring remaps only logged
+ * ranges from the image, so it costs O(dirty pages).
+ * If the log overflows, whole address space is remapped instead.
+ */
+
+static struct EnvSnapshot snapshots[NSNAPSHOT];
+
+/* Map [start, end) of snapshot image back into env */
+static int
+snapshot_revert(struct Env *env, struct EnvSnapshot *snap, uintptr_t start, uintptr_t end) {
+    unmap_region(&env->address_space, start, end - start);
+    return map_region(&env->address_space, start, &snap->image, start,
+                      end - start, PROT_ALL | PROT_LAZY | PROT_COMBINE);
+}
+
+/* Takes new snapshot of env replacing the old one */
+int
+snapshot_take(struct Env *env) {
+    struct EnvSnapshot *snap = env->env_snapshot;
+    if (snap) {
+        snapshot_release_step(env, (size_t)-1);
+        assert(!env->env_snapshot);
+    }
+
+    for (snap = snapshots; snap < snapshots + NSNAPSHOT && snap->env; snap++)
+        ;
+    if (snap == snapshots + NSNAPSHOT) return -E_NO_MEM;
+
+    int res = init_address_space(&snap->image);
+    if (res < 0) return res;
+
+    /* Both env and image get lazy copies of private pages */
+    res = map_region(&snap->image, 0, &env->address_space, 0,
+                     MAX_USER_ADDRESS, PROT_ALL | PROT_LAZY | PROT_COMBINE);
+    if (res < 0) {
+        release_address_space(&snap->image);
+        return res;
+    }
+
+    snap->tf = env->env_tf;
+    snap->ndirty = 0;
+    snap->overflow = 0;
+    snap->env = env;
+    env->env_snapshot = snap;
+
+    if (trace_envs) cprintf("[%08x] snapshot env %08x\n", curenv ? curenv->env_id : 0, env->env_id);
+    return 0;
+}
+
+/* Reverts env to its snapshot */
+int
+snapshot_restore(struct Env *env) {
+    struct EnvSnapshot *snap = env->env_snapshot;
+    if (!snap) return -E_INVAL;
+
+    int res = 0;
+    if (snap->overflow) {
+        res = snapshot_revert(env, snap, 0, MAX_USER_ADDRESS);
+    } else {
+        for (size_t i = 0; i < snap->ndirty && !res; i++)
+            res = snapshot_revert(env, snap, snap->dirty[i].start, snap->dirty[i].end);
+    }
+    if (res < 0) return res;
+
+    if (trace_envs) {
+        cprintf("[%08x] restore env %08x (%zu dirty ranges%s)\n", curenv ? curenv->env_id : 0,
+                env->env_id, snap->ndirty, snap->overflow ? ", overflow" : "");
+    }
+
+    env->env_tf = snap->tf;
+    snap->ndirty = 0;
+    snap->overflow = 0;
+    return 0;
+}
+
+/* Records that [addr, addr + size) of env is going to be modified */
+void
+snapshot_dirty(struct Env *env, uintptr_t addr, size_t size) {
+    struct EnvSnapshot *snap = env->env_snapshot;
+    if (!snap || snap->overflow) return;
+
+    uintptr_t start = ROUNDDOWN(addr, PAGE_SIZE);
+    uintptr_t end = MIN(ROUNDUP(addr + size, PAGE_SIZE), MAX_USER_ADDRESS);
+    if (start >= end) return;
+
+    /* Consecutive faults usually hit adjacent pages */
+    if (snap->ndirty) {
+        struct DirtyRange *last = &snap->dirty[snap->ndirty - 1];
+        if (start <= last->end && last->start <= end) {
+            last->start = MIN(last->start, start);
+            last->end = MAX(last->end, end);
+            return;
+        }
+    }
+
+    if (snap->ndirty == SNAPSHOT_LOG_SIZE) {
+        snap->overflow = 1;
+        return;
+    }
+
+    snap->dirty[snap->ndirty++] = (struct DirtyRange){start, end};
+}
+
+/* Releases at most budget 2MB chunks of snapshot image
+ * (see release_address_space_step()).
+ * Returns true if snapshot is released completely */
+bool
+snapshot_release_step(struct Env *env, size_t budget) {
+    struct EnvSnapshot *snap = env->env_snapshot;
+    if (!snap) return 1;
+
+    if (!release_address_space_step(&snap->image, budget)) return 0;
+
+    snap->env = NULL;
+    env->env_snapshot = NULL;
+    return 1;
+}
@@ -0,0 +1,36 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SNAPSHOT_H
+#define JOS_KERN_SNAPSHOT_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+#define NSNAPSHOT         16
+#define SNAPSHOT_LOG_SIZE 256
+
+/* Range of user address space [start, end)
+ * modified since the snapshot was taken */
+struct DirtyRange {
+    uintptr_t start, end;
+};
+
+struct EnvSnapshot {
+    struct Env *env;           /* Owner (NULL if snapshot is free) */
+    struct Trapframe tf;       /* Saved registers */
+    struct AddressSpace image; /* Copy-on-write memory image */
+
+    size_t ndirty;             /* Number of used dirty log entries */
+    bool overflow;             /* Log is full, whole space needs restoring */
+    struct DirtyRange dirty[SNAPSHOT_LOG_SIZE];
+};
+
+int snapshot_take(struct Env *env);
+int snapshot_restore(struct Env *env);
+void snapshot_dirty(struct Env *env, uintptr_t addr, size_t size);
+bool snapshot_release_step(struct Env *env, size_t budget);
+
+#endif /* !JOS_KERN_SNAPSHOT_H */
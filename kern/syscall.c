@@ -7,12 +7,18 @@
 
 #include <kern/console.h>
 #include <kern/env.h>
+#include <kern/futex.h>
 #include <kern/kclock.h>
+#include <kern/kmalloc.h>
+#include <kern/numa.h>
 #include <kern/pmap.h>
 #include <kern/sched.h>
+#include <kern/snapshot.h>
 #include <kern/syscall.h>
 #include <kern/trap.h>
 #include <kern/traceopt.h>
+#include <kern/vsyscall.h>
+#include <kern/wait.h>
 
 /* Print a string to the system console.
  * The string is exactly 'len' characters long.
@@ -75,11 +81,13 @@ sys_env_destroy(envid_t envid) {
     return 0;
 }
 
-/* Deschedule current environment and pick a different one to run. */
+/* Deschedule current environment and pick a different one to run.
+ * Real-time environment completes its job for the current period. */
 static void
 sys_yield(void) {
     // LAB 9: Your code here
 
+    sched_rt_yield(curenv);
     sched_yield();
 }
 
@@ -101,10 +109,20 @@ sys_exofork(void) {
     int res = env_alloc(&newenv, curenv->env_id, ENV_TYPE_USER);
     if (res < 0) return res;
 
-    newenv->env_status = ENV_NOT_RUNNABLE;
+    env_set_status(newenv, ENV_NOT_RUNNABLE);
     memcpy((void*) &newenv->env_tf, (void*) &curenv->env_tf, sizeof(struct Trapframe));
     newenv->env_tf.tf_regs.reg_rax = 0;
 
+    /* Child inherits memory policy */
+    newenv->env_mempolicy = curenv->env_mempolicy;
+    newenv->env_memnodes = curenv->env_memnodes;
+
+    /* and CPU share, it starts where parent is
+     * so that forking doesn't give extra CPU time
+     * (real-time reservation is not inherited) */
+    newenv->env_weight = curenv->env_weight;
+    newenv->env_vruntime = curenv->env_vruntime;
+
     return newenv->env_id;
 }
 
@@ -114,7 +132,8 @@ sys_exofork(void) {
  * Returns 0 on success, < 0 on error.  Errors are:
  *  -E_BAD_ENV if environment envid doesn't currently exist,
  *      or the caller doesn't have permission to change envid.
- *  -E_INVAL if status is not a valid status for an environment. */
+ *  -E_INVAL if status is not a valid status for an environment,
+ *      or if the environment is blocked in a system call (see env_blocked()). */
 static int
 sys_env_set_status(envid_t envid, int status) {
     /* Hint: Use the 'envid2env' function from kern/env.c to translate an
@@ -125,14 +144,18 @@ sys_env_set_status(envid_t envid, int status) {
 
     // LAB 9: Your code here
 
-    if (status < ENV_FREE || status > ENV_NOT_RUNNABLE)
+    if (status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE)
         return -E_INVAL;
 
     struct Env* targetenv = NULL;
     int res = envid2env(envid, &targetenv, true);
     if (res < 0) return res;
 
-    targetenv->env_status = status;
+    /* Blocked env is still linked to wait queues,
+     * waking it up here would leave stale entries there */
+    if (status == ENV_RUNNABLE && env_blocked(targetenv)) return -E_INVAL;
+
+    env_set_status(targetenv, status);
     return 0;
 }
 
@@ -196,6 +219,7 @@ sys_alloc_region(envid_t envid, uintptr_t addr, size_t size, int perm) {
     if (!(perm & ALLOC_ZERO) && !(perm & ALLOC_ONE))
         perm |= ALLOC_ZERO;
 
+    snapshot_dirty(targetenv, addr, size);
     res = map_region(&targetenv->address_space, addr, NULL, 0, size, perm | PROT_USER_ | PROT_LAZY | ALLOC_ZERO);
     if (res < 0) return res;
 
@@ -242,6 +266,7 @@ sys_map_region(envid_t srcenvid, uintptr_t srcva,
     if ((perm & (~PROT_ALL)) != 0)
         return -E_INVAL;
 
+    snapshot_dirty(dstenv, dstva, size);
     res = map_region(&dstenv->address_space, dstva, 
                      &srcenv->address_space, srcva, size, perm | PROT_USER_);
     if (res < 0) return res;
@@ -249,6 +274,67 @@ sys_map_region(envid_t srcenvid, uintptr_t srcva,
     return 0;
 }
 
+/* Number of descriptors sys_map_regions() copies
+ * from user memory and applies at once */
+#define MAP_REGIONS_BATCH 32
+
+/* Vectored sys_map_region(): maps 'count' regions described by
+ * 'vec' from srcenvid's address space to dstenvid's address space.
+ * Environments are looked up once, descriptors are copied and validated
+ * in batches of MAP_REGIONS_BATCH and TLB is invalidated once per batch.
+ * Regions mapped before the failing descriptor stay mapped.
+ *
+ * Return 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
+ *      or the caller doesn't have permission to change one of them.
+ *  -E_INVAL if any region is not page-aligned or not below MAX_USER_ADDRESS,
+ *      or its perm is inappropriate (see sys_map_region).
+ *  -E_NO_MEM if there's no memory to allocate any necessary page tables.
+ * Destroys the environment if vec is not readable. */
+static int
+sys_map_regions(envid_t srcenvid, envid_t dstenvid, uintptr_t vec, size_t count) {
+    struct Env *srcenv = NULL, *dstenv = NULL;
+    int res = envid2env(srcenvid, &srcenv, true);
+    if (res < 0) return res;
+    res = envid2env(dstenvid, &dstenv, true);
+    if (res < 0) return res;
+
+    if (count > MAX_USER_ADDRESS / sizeof(struct MapRegion)) return -E_INVAL;
+
+    struct MapRegion batch[MAP_REGIONS_BATCH];
+    for (size_t i = 0; i < count; i += MAP_REGIONS_BATCH) {
+        size_t n = MIN(count - i, MAP_REGIONS_BATCH);
+
+        /* Descriptors are copied before any mapping changes
+         * since earlier batches could remap vec itself */
+        struct MapRegion *uvec = (struct MapRegion *)vec + i;
+        user_mem_assert(curenv, uvec, n * sizeof(*uvec), PROT_R);
+        memcpy(batch, uvec, n * sizeof(*uvec));
+
+        for (size_t j = 0; j < n; j++) {
+            struct MapRegion *reg = &batch[j];
+            if (reg->src & CLASS_MASK(0) || reg->dst & CLASS_MASK(0) ||
+                reg->src >= MAX_USER_ADDRESS || reg->dst >= MAX_USER_ADDRESS ||
+                reg->size > MAX_USER_ADDRESS - reg->src ||
+                reg->size > MAX_USER_ADDRESS - reg->dst ||
+                reg->perm & ~PROT_ALL) return -E_INVAL;
+        }
+
+        tlb_batch_begin();
+        for (size_t j = 0; j < n && !res; j++) {
+            struct MapRegion *reg = &batch[j];
+            snapshot_dirty(dstenv, reg->dst, reg->size);
+            res = map_region(&dstenv->address_space, reg->dst, &srcenv->address_space,
+                             reg->src, reg->size, reg->perm | PROT_USER_);
+        }
+        tlb_batch_end();
+
+        if (res < 0) return res;
+    }
+
+    return 0;
+}
+
 /* Unmap the region of memory at 'va' in the address space of 'envid'.
  * If no page is mapped, the function silently succeeds.
  *
@@ -269,11 +355,115 @@ sys_unmap_region(envid_t envid, uintptr_t va, size_t size) {
     if (va >= MAX_USER_ADDRESS || (va % PAGE_SIZE) != 0)
         return -E_INVAL;
 
+    snapshot_dirty(targetenv, va, size);
     unmap_region(&targetenv->address_space, va, size);
 
     return 0;
 }
 
+/* Target accepts message from sender if it is blocked in sys_ipc_recv()
+ * or waits for a reply from sender in sys_ipc_call() */
+static bool
+ipc_accepts(struct Env *target, struct Env *sender) {
+    return target->env_ipc_recving && !target->env_ipc_send_to &&
+           (!target->env_ipc_recv_from || target->env_ipc_recv_from == sender->env_id);
+}
+
+/* Delivers IPC message from sender to target blocked in sys_ipc_recv()
+ * and makes target runnable (see sys_ipc_try_send() for details).
+ * 'words' are message words of sys_ipc_send_regs(), NULL for
+ * single value message which is delivered as the first word. */
+static int
+ipc_deliver(struct Env *target, struct Env *sender, uint32_t value, const uint64_t *words,
+            uintptr_t srcva, size_t size, int perm) {
+    assert(ipc_accepts(target, sender));
+
+    if (srcva < MAX_USER_ADDRESS && target->env_ipc_dstva < MAX_USER_ADDRESS)
+    {
+        size_t min_size = MIN(target->env_ipc_maxsz, size);
+
+        snapshot_dirty(target, target->env_ipc_dstva, min_size);
+        if (perm & MAP_MOVE) snapshot_dirty(sender, srcva, min_size);
+        int res = map_region(&target->address_space, target->env_ipc_dstva, &sender->address_space, srcva, min_size, perm | PROT_USER_);
+        if (res < 0) return res;
+
+        target->env_ipc_maxsz = min_size;
+        target->env_ipc_perm = 0;
+    }
+    else 
+        target->env_ipc_perm = 0;
+
+    target->env_ipc_recving = false;
+    env_ipc_recv_any(target);
+    target->env_ipc_value = value;
+    target->env_ipc_from = sender->env_id;
+
+    if (target->env_ipc_regs) {
+        struct PushRegs *regs = &target->env_tf.tf_regs;
+        regs->reg_rdx = words ? words[0] : value;
+        regs->reg_rcx = words ? words[1] : 0;
+        regs->reg_rbx = words ? words[2] : 0;
+        regs->reg_rdi = words ? words[3] : 0;
+        regs->reg_rsi = words ? words[4] : 0;
+        regs->reg_r8 = words ? words[5] : 0;
+        /* SYSRET would not restore these registers */
+        target->env_tf.tf_trapno = T_SYSCALL;
+        target->env_ipc_regs = false;
+    }
+
+    env_set_status(target, ENV_RUNNABLE);
+
+    return 0;
+}
+
+static bool
+ipc_mbox_full(struct Env *env) {
+    return env->env_mbox_tail - env->env_mbox_head >= env->env_mbox_depth;
+}
+
+/* Queues message from sender in target's mailbox which should have room.
+ * Region is mapped into target's grant window slot right away.
+ * Wakes target up if it is blocked in sys_ipc_recv_batch(). */
+static int
+ipc_mbox_put(struct Env *target, struct Env *sender, uint32_t value, const uint64_t *words,
+             uintptr_t srcva, size_t size, int perm) {
+    assert(!ipc_mbox_full(target));
+
+    uint32_t slot = target->env_mbox_tail % target->env_mbox_depth;
+    struct IpcMessage *msg = &target->env_mbox[slot];
+
+    msg->va = MAX_USER_ADDRESS;
+    msg->size = 0;
+    msg->perm = 0;
+    if (srcva < MAX_USER_ADDRESS && target->env_mbox_grant_va < MAX_USER_ADDRESS) {
+        uintptr_t dstva = target->env_mbox_grant_va + slot * target->env_mbox_grant_size;
+        size = MIN(size, target->env_mbox_grant_size);
+
+        snapshot_dirty(target, dstva, size);
+        if (perm & MAP_MOVE) snapshot_dirty(sender, srcva, size);
+        int res = map_region(&target->address_space, dstva, &sender->address_space, srcva, size, perm | PROT_USER_);
+        if (res < 0) return res;
+
+        msg->va = dstva;
+        msg->size = size;
+        msg->perm = perm;
+    }
+
+    msg->from = sender->env_id;
+    msg->value = value;
+    for (size_t i = 0; i < IPC_MAX_WORDS; i++)
+        msg->words[i] = words ? words[i] : i ? 0 : value;
+    target->env_mbox_tail++;
+
+    if (target->env_mbox_waiting) {
+        target->env_mbox_waiting = false;
+        env_set_status(target, ENV_RUNNABLE);
+    }
+    wait_ipc_notify(target, sender->env_id);
+
+    return 0;
+}
+
 /* Try to send 'value' to the target env 'envid'.
  * If srcva < MAX_USER_ADDRESS, then also send region currently mapped at 'srcva',
  * so receiver also gets mapping.
@@ -296,6 +486,9 @@ sys_unmap_region(envid_t envid, uintptr_t va, size_t size) {
  *
  * If the sender wants to send a page but the receiver isn't asking for one,
  * then no page mapping is transferred, but no error occurs.
+ * With MAP_MOVE in perm the transferred part of the region is unmapped
+ * from the sender instead of being shared, so the receiver gets
+ * private pages without copying (see do_move_page()).
  * Send region size is the minimum of sized specified in sys_ipc_try_send() and sys_ipc_recv()
  * 
  * The ipc only happens when no errors occur.
@@ -305,7 +498,9 @@ sys_unmap_region(envid_t envid, uintptr_t va, size_t size) {
  *  -E_BAD_ENV if environment envid doesn't currently exist.
  *      (No need to check permissions.)
  *  -E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
- *      or another environment managed to send first.
+ *      or another environment managed to send first,
+ *      and it has no mailbox (see sys_ipc_mailbox).
+ *  -E_MAILBOX_FULL if envid is not receiving and its mailbox is full.
  *  -E_INVAL if srcva < MAX_USER_ADDRESS but srcva is not page-aligned.
  *  -E_INVAL if srcva < MAX_USER_ADDRESS and perm is inappropriate
  *      (see sys_page_alloc).
@@ -323,32 +518,149 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
     int res = envid2env(envid, &targetenv, false);
     if (res < 0) return res;
 
-    if (targetenv->env_ipc_recving != true)
+    if (ipc_accepts(targetenv, curenv))
+        return ipc_deliver(targetenv, curenv, value, NULL, srcva, size, perm);
+
+    if (!targetenv->env_mbox_depth)
         return -E_IPC_NOT_RECV;
 
-    if (srcva < MAX_USER_ADDRESS && targetenv->env_ipc_dstva < MAX_USER_ADDRESS)
-    {
-        size_t min_size = MIN(targetenv->env_ipc_maxsz, size);
+    if (ipc_mbox_full(targetenv)) {
+        targetenv->env_mbox_overflows++;
+        return -E_MAILBOX_FULL;
+    }
 
-        res = map_region(&targetenv->address_space, targetenv->env_ipc_dstva, &curenv->address_space, srcva, min_size, perm | PROT_USER_);
-        // res = sys_map_region(envid, targetenv->env_ipc_dstva, curenv->env_id, srcva, min_size, perm);
-        if (res < 0) return res;
+    if (srcva < MAX_USER_ADDRESS && (srcva & CLASS_MASK(0) || perm & ~(PROT_ALL | MAP_MOVE)))
+        return -E_INVAL;
 
-        targetenv->env_ipc_maxsz = min_size;
-        targetenv->env_ipc_perm = 0;
-    }
-    else 
-        targetenv->env_ipc_perm = 0;
+    return ipc_mbox_put(targetenv, curenv, value, NULL, srcva, size, perm);
+}
 
-    targetenv->env_ipc_recving = false;
-    targetenv->env_ipc_value = value;
-    targetenv->env_ipc_from = curenv->env_id;
+/* Queues curenv on target's wait queue with the message
+ * which is handed off by target's next sys_ipc_recv() */
+static void
+ipc_block_send(struct Env *target, uint32_t value, const uint64_t *words, uintptr_t srcva, size_t size, int perm) {
+    curenv->env_ipc_send_value = value;
+    for (size_t i = 0; i < IPC_MAX_WORDS; i++)
+        curenv->env_ipc_send_words[i] = words ? words[i] : i ? 0 : value;
+    curenv->env_ipc_send_srcva = srcva;
+    curenv->env_ipc_send_size = size;
+    curenv->env_ipc_send_perm = perm;
+    env_ipc_enqueue(target, curenv);
+
+    env_sleep(curenv);
+    wait_ipc_notify(target, curenv->env_id);
+}
 
-    targetenv->env_status = ENV_RUNNABLE;
+/* Sends message to target that is not receiving: queues it in target's
+ * mailbox if there is room, otherwise blocks curenv on target */
+static int
+ipc_queue_send(struct Env *target, uint32_t value, const uint64_t *words, uintptr_t srcva, size_t size, int perm) {
+    if (target->env_mbox_depth && !ipc_mbox_full(target))
+        return ipc_mbox_put(target, curenv, value, words, srcva, size, perm);
 
+    ipc_block_send(target, value, words, srcva, size, perm);
     return 0;
 }
 
+/* Makes sender blocked on curenv runnable after its message was taken
+ * with result 'res'. Caller of sys_ipc_call() keeps waiting for the reply. */
+static void
+ipc_wake_sender(struct Env *sender, int res) {
+    if (res < 0 || !sender->env_ipc_recving) {
+        sender->env_ipc_recving = false;
+        env_ipc_recv_any(sender);
+        sender->env_tf.tf_regs.reg_rax = res;
+        env_set_status(sender, ENV_RUNNABLE);
+    }
+}
+
+/* Moves messages of senders blocked on env into its mailbox while there is room */
+static void
+ipc_mbox_refill(struct Env *env) {
+    struct Env *sender;
+    while (env->env_mbox_depth && !ipc_mbox_full(env) && (sender = env_ipc_dequeue(env))) {
+        int res = ipc_mbox_put(env, sender, sender->env_ipc_send_value, sender->env_ipc_send_words,
+                               sender->env_ipc_send_srcva, sender->env_ipc_send_size, sender->env_ipc_send_perm);
+        ipc_wake_sender(sender, res);
+    }
+}
+
+/* Blocking version of sys_ipc_try_send(). If the target is not
+ * receiving yet, the caller is queued on target's wait queue
+ * and marked not runnable. The message is handed off by target's
+ * next sys_ipc_recv() which also sets sender's return value.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are the same as
+ * for sys_ipc_try_send() except -E_IPC_NOT_RECV, and also
+ *  -E_BAD_ENV if target is destroyed while sender is blocked. */
+static int
+sys_ipc_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, int perm) {
+    struct Env *targetenv = NULL;
+    int res = envid2env(envid, &targetenv, false);
+    if (res < 0) return res;
+
+    if (srcva < MAX_USER_ADDRESS && (srcva & CLASS_MASK(0) || perm & ~(PROT_ALL | MAP_MOVE)))
+        return -E_INVAL;
+
+    if (ipc_accepts(targetenv, curenv))
+        return ipc_deliver(targetenv, curenv, value, NULL, srcva, size, perm);
+
+    if (targetenv == curenv) return -E_INVAL;
+
+    return ipc_queue_send(targetenv, value, NULL, srcva, size, perm);
+}
+
+/* Register IPC: sends up to IPC_MAX_WORDS 64-bit 'words' to 'envid' like
+ * sys_ipc_send() without a region. Receiver of sys_ipc_recv_regs() gets
+ * them in its argument registers, receiver of sys_ipc_recv() gets
+ * the low 32 bits of the first word as env_ipc_value.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist.
+ *  -E_BAD_ENV if target is destroyed while sender is blocked.
+ *  -E_INVAL if envid is the caller itself and it is not receiving. */
+static int
+sys_ipc_send_regs(envid_t envid, const uint64_t *words) {
+    struct Env *targetenv = NULL;
+    int res = envid2env(envid, &targetenv, false);
+    if (res < 0) return res;
+
+    if (ipc_accepts(targetenv, curenv))
+        return ipc_deliver(targetenv, curenv, words[0], words, MAX_USER_ADDRESS, 0, 0);
+
+    if (targetenv == curenv) return -E_INVAL;
+
+    return ipc_queue_send(targetenv, words[0], words, MAX_USER_ADDRESS, 0, 0);
+}
+
+/* Starts receiving into [dstva, dstva + maxsize). Takes the message of
+ * the oldest sender blocked on curenv if there is one, in which case
+ * curenv stays running, otherwise blocks curenv. */
+static void
+ipc_start_recv(uintptr_t dstva, uintptr_t maxsize, bool regs) {
+    curenv->env_ipc_recving = true;
+    curenv->env_ipc_regs = regs;
+    env_ipc_recv_any(curenv);
+    curenv->env_ipc_dstva = dstva;
+    curenv->env_ipc_maxsz = maxsize;
+    curenv->env_tf.tf_regs.reg_rax = 0;
+
+    struct Env *sender;
+    while ((sender = env_ipc_dequeue(curenv))) {
+        int res = ipc_deliver(curenv, sender, sender->env_ipc_send_value, sender->env_ipc_send_words,
+                              sender->env_ipc_send_srcva, sender->env_ipc_send_size, sender->env_ipc_send_perm);
+
+        ipc_wake_sender(sender, res);
+
+        if (!res) {
+            env_set_status(curenv, ENV_RUNNING);
+            return;
+        }
+    }
+
+    env_sleep(curenv);
+}
+
 /* Block until a value is ready.  Record that you want to receive
  * using the env_ipc_recving, env_ipc_maxsz and env_ipc_dstva fields of struct Env,
  * mark yourself not runnable, and then give up the CPU.
@@ -356,6 +668,9 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
  * If 'dstva' is < MAX_USER_ADDRESS, then you are willing to receive a page of data.
  * 'dstva' is the virtual address at which the sent page should be mapped.
  *
+ * If senders are already blocked in sys_ipc_send() on this environment,
+ * the oldest one hands off its message immediately and becomes runnable.
+ *
  * This function only returns on error, but the system call will eventually
  * return 0 on success.
  * Return < 0 on error.  Errors are:
@@ -374,17 +689,478 @@ sys_ipc_recv(uintptr_t dstva, uintptr_t maxsize) {
      && (maxsize == 0 || (maxsize % PAGE_SIZE) != 0))
         return -E_INVAL;
 
-    curenv->env_ipc_recving = true;
-    curenv->env_ipc_dstva = dstva;
-    curenv->env_ipc_maxsz = maxsize;
+    ipc_start_recv(dstva, maxsize, false);
+
+    // no return
+    return 0;
+}
+
+/* Like sys_ipc_recv() without a region, but message words are returned
+ * in rdx, rcx, rbx, rdi, rsi and r8 (see sys_ipc_send_regs()).
+ * Single value message arrives as the first word, other words are 0.
+ * Sender is in env_ipc_from.
+ *
+ * Always returns 0. */
+static int
+sys_ipc_recv_regs(void) {
+    ipc_start_recv(MAX_USER_ADDRESS, 0, true);
+    return 0;
+}
+
+/* Sets up mailbox of curenv for up to 'depth' messages (at most
+ * IPC_MAILBOX_MAX). While curenv is not blocked in sys_ipc_recv(),
+ * messages sent to it are queued in the mailbox: sys_ipc_try_send()
+ * fails with -E_MAILBOX_FULL (and it is counted in env_mbox_overflows)
+ * if there is no room, sys_ipc_send() blocks until there is.
+ * If 'grant_va' < MAX_USER_ADDRESS, region of the message in mailbox
+ * slot i is mapped at grant_va + i * grant_size (up to 'grant_size'
+ * bytes), so it should be moved away before the slot is reused.
+ * Otherwise regions are not transferred. Depth 0 disables the mailbox.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_INVAL if depth is too large or the mailbox is not empty.
+ *  -E_INVAL if depth > 0, grant_va < MAX_USER_ADDRESS and grant window is not
+ *      page aligned, empty or doesn't fit below MAX_USER_ADDRESS.
+ *  -E_NO_MEM if there's no memory for the mailbox. */
+static int
+sys_ipc_mailbox(size_t depth, uintptr_t grant_va, size_t grant_size) {
+    if (depth > IPC_MAILBOX_MAX) return -E_INVAL;
+    if (curenv->env_mbox_tail != curenv->env_mbox_head) return -E_INVAL;
+
+    if (depth && grant_va < MAX_USER_ADDRESS) {
+        if (grant_va & CLASS_MASK(0) || !grant_size || grant_size & CLASS_MASK(0)) return -E_INVAL;
+        if (grant_size > (MAX_USER_ADDRESS - grant_va) / depth) return -E_INVAL;
+    }
+
+    if (depth && !curenv->env_mbox) {
+        static struct KmemCache *mbox_cache;
+        if (!mbox_cache) mbox_cache = kmem_cache_create("ipc_mailbox", IPC_MAILBOX_MAX * sizeof(struct IpcMessage), 0, 0);
+        if (mbox_cache && (curenv->env_mbox = kmem_cache_alloc(mbox_cache)))
+            memset(curenv->env_mbox, 0, mbox_cache->size);
+        if (!curenv->env_mbox) return -E_NO_MEM;
+    }
+
+    curenv->env_mbox_depth = depth;
+    curenv->env_mbox_head = curenv->env_mbox_tail = 0;
+    curenv->env_mbox_grant_va = grant_va;
+    curenv->env_mbox_grant_size = grant_size;
+    ipc_mbox_refill(curenv);
+    return 0;
+}
+
+/* Copies up to 'count' messages from curenv's mailbox to 'buf' and
+ * moves messages of blocked senders into the freed slots.
+ * If the mailbox is empty, blocks until a message arrives and returns 0,
+ * so the call should be repeated.
+ *
+ * Returns number of messages received, < 0 on error.  Errors are:
+ *  -E_INVAL if curenv has no mailbox or count is 0. */
+static int
+sys_ipc_recv_batch(uintptr_t buf, size_t count) {
+    if (!curenv->env_mbox_depth || !count) return -E_INVAL;
+
+    count = MIN(count, curenv->env_mbox_depth);
+    user_mem_assert(curenv, (void *)buf, count * sizeof(struct IpcMessage), PROT_W | PROT_USER_);
+
+    ipc_mbox_refill(curenv);
+
+    uint32_t head = curenv->env_mbox_head;
+    count = MIN(count, curenv->env_mbox_tail - head);
+    if (!count) {
+        curenv->env_mbox_waiting = true;
+        env_sleep(curenv);
+        curenv->env_tf.tf_regs.reg_rax = 0;
+        return 0;
+    }
+
+    struct IpcMessage *msgs = (struct IpcMessage *)buf;
+    for (size_t i = 0; i < count; i++)
+        msgs[i] = curenv->env_mbox[(head + i) % curenv->env_mbox_depth];
+    curenv->env_mbox_head = head + count;
+
+    ipc_mbox_refill(curenv);
+    return count;
+}
+
+/* Synchronous IPC call: sends message to 'envid' like sys_ipc_send()
+ * and waits for the reply from 'envid' only (reply carries no region).
+ * If the target is already receiving, control is handed off to it
+ * directly, bypassing the scheduler.
+ * The reply value is in env_ipc_value as for sys_ipc_recv().
+ *
+ * Returns 0 on success, < 0 on error.  Errors are the same as
+ * for sys_ipc_send(), and also
+ *  -E_INVAL if envid is the caller itself. */
+static int
+sys_ipc_call(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, int perm) {
+    struct Env *targetenv = NULL;
+    int res = envid2env(envid, &targetenv, false);
+    if (res < 0) return res;
+
+    if (targetenv == curenv) return -E_INVAL;
+    if (srcva < MAX_USER_ADDRESS && (srcva & CLASS_MASK(0) || perm & ~(PROT_ALL | MAP_MOVE)))
+        return -E_INVAL;
+
+    bool direct = ipc_accepts(targetenv, curenv);
+    if (direct) {
+        res = ipc_deliver(targetenv, curenv, value, NULL, srcva, size, perm);
+        if (res < 0) return res;
+    } else {
+        res = ipc_queue_send(targetenv, value, NULL, srcva, size, perm);
+        if (res < 0) return res;
+    }
 
-    curenv->env_status = ENV_NOT_RUNNABLE;
+    /* Closed receive of the reply */
+    curenv->env_ipc_recving = true;
+    env_ipc_wait_reply(targetenv, curenv);
+    curenv->env_ipc_regs = false;
+    curenv->env_ipc_dstva = MAX_USER_ADDRESS;
+    curenv->env_ipc_maxsz = 0;
+    env_sleep(curenv);
     curenv->env_tf.tf_regs.reg_rax = 0;
 
-    // no return
+    if (direct) sched_handoff(targetenv);
+    return 0;
+}
+
+/* Server side of sys_ipc_call(): sends register-only reply 'value' to
+ * 'envid' waiting for it in sys_ipc_call() and starts receiving the next
+ * message like sys_ipc_recv(). If no message is pending, control is handed
+ * off to the client directly. With envid == 0 it is just sys_ipc_recv().
+ *
+ * Returns 0 on success, < 0 on error.  Errors are the same as
+ * for sys_ipc_recv(), and also
+ *  -E_BAD_ENV if envid doesn't currently exist.
+ *  -E_IPC_NOT_RECV if envid is not waiting for a reply from the caller.
+ * No message is received on error. */
+static int
+sys_ipc_reply_recv(envid_t envid, uint32_t value, uintptr_t dstva, uintptr_t maxsize) {
+    if (dstva < MAX_USER_ADDRESS && (dstva & CLASS_MASK(0) || !maxsize || maxsize & CLASS_MASK(0)))
+        return -E_INVAL;
+
+    struct Env *client = NULL;
+    if (envid) {
+        int res = envid2env(envid, &client, false);
+        if (res < 0) return res;
+
+        if (!ipc_accepts(client, curenv) || client->env_ipc_recv_from != curenv->env_id)
+            return -E_IPC_NOT_RECV;
+
+        res = ipc_deliver(client, curenv, value, NULL, MAX_USER_ADDRESS, 0, 0);
+        assert(!res);
+    }
+
+    ipc_start_recv(dstva, maxsize, false);
+
+    if (client && curenv->env_status != ENV_RUNNING) sched_handoff(client);
+    return 0;
+}
+
+/* Translates 32-bit word address to futex key (physical address) */
+static physaddr_t
+futex_key(uintptr_t addr, int perm) {
+    if (addr & (sizeof(uint32_t) - 1)) return 0;
+    if (user_mem_check(curenv, (void *)addr, sizeof(uint32_t), perm | PROT_USER_) < 0) return 0;
+    return user_mem_paddr(&curenv->address_space, addr);
+}
+
+/* Blocks until sys_futex_wake() is called on the 32-bit word at 'addr'
+ * (by any environment mapping the same memory) if the word still
+ * contains 'expected'. 'timeout' is in nanoseconds, 0 means no timeout.
+ * Wakeups might be spurious, the word should be checked again.
+ *
+ * Returns 0 on wakeup, < 0 on error.  Errors are:
+ *  -E_INVAL if addr is not aligned to 4 bytes or not mapped.
+ *  -E_AGAIN if the word doesn't contain 'expected'.
+ *  -E_TIMEOUT if timeout expired. */
+static int
+sys_futex_wait(uintptr_t addr, uint32_t expected, uint64_t timeout) {
+    physaddr_t key = futex_key(addr, PROT_R);
+    if (!key) return -E_INVAL;
+
+    if (*(volatile uint32_t *)addr != expected) return -E_AGAIN;
+
+    futex_queue(curenv, 0, key);
+    wait_block(curenv, timeout ? vsys_now() + timeout : 0, 0, false);
+    return 0;
+}
+
+/* Wakes up to 'count' environments waiting on the word at 'addr'.
+ *
+ * Returns number of woken environments, < 0 on error.  Errors are:
+ *  -E_INVAL if addr is not aligned to 4 bytes or not mapped. */
+static int
+sys_futex_wake(uintptr_t addr, int count) {
+    physaddr_t key = futex_key(addr, PROT_R);
+    if (!key) return -E_INVAL;
+
+    return futex_wake(key, count);
+}
+
+/* Message from 'from' (0 - any) is queued in env's mailbox
+ * or its sender is blocked on env */
+static bool
+ipc_pending(struct Env *env, envid_t from) {
+    for (uint32_t i = env->env_mbox_head; i != env->env_mbox_tail; i++)
+        if (!from || env->env_mbox[i % env->env_mbox_depth].from == from) return true;
+
+    for (struct Env *sender = env->env_ipc_senders; sender; sender = sender->env_ipc_next_sender)
+        if (!from || sender->env_id == from) return true;
+
+    return false;
+}
+
+/* Blocks until any of 'count' events at 'events' is ready (see struct WaitEvent).
+ * Events that are ready at the time of the call are all reported at once,
+ * after blocking only the events that woken curenv up are.
+ * WAIT_IPC events are signalled by messages queued in the mailbox
+ * (see sys_ipc_mailbox) and by senders blocked in sys_ipc_send(),
+ * the message itself should be received with the usual calls.
+ *
+ * Returns the ready set, bit i is set if events[i] is ready,
+ * < 0 on error.  Errors are:
+ *  -E_INVAL if count is 0 or greater than WAIT_MAX_EVENTS.
+ *  -E_INVAL if event type is unknown.
+ *  -E_INVAL if WAIT_FUTEX word is not aligned to 4 bytes or not mapped. */
+static int
+sys_wait(uintptr_t events, size_t count) {
+    if (!count || count > WAIT_MAX_EVENTS) return -E_INVAL;
+    user_mem_assert(curenv, (void *)events, count * sizeof(struct WaitEvent), PROT_R | PROT_USER_);
+
+    struct WaitEvent evs[WAIT_MAX_EVENTS];
+    memcpy(evs, (void *)events, count * sizeof(struct WaitEvent));
+
+    physaddr_t keys[WAIT_MAX_EVENTS] = {0};
+    uint64_t now = vsys_now(), deadline = 0;
+    uint32_t ready = 0, timer = 0;
+    for (size_t i = 0; i < count; i++) {
+        switch (evs[i].type) {
+        case WAIT_IPC:
+            if (ipc_pending(curenv, evs[i].envid)) ready |= 1U << i;
+            break;
+        case WAIT_FUTEX:
+            if (!(keys[i] = futex_key(evs[i].addr, PROT_R))) return -E_INVAL;
+            if (*(volatile uint32_t *)evs[i].addr != evs[i].value) ready |= 1U << i;
+            break;
+        case WAIT_TIMER:
+            if (evs[i].deadline <= now) {
+                ready |= 1U << i;
+            } else if (!deadline || evs[i].deadline < deadline) {
+                deadline = evs[i].deadline;
+                timer = 1U << i;
+            } else if (evs[i].deadline == deadline) {
+                timer |= 1U << i;
+            }
+            break;
+        case WAIT_CONSOLE:
+            if (cons_pending()) ready |= 1U << i;
+            break;
+        default:
+            return -E_INVAL;
+        }
+    }
+    if (ready) return ready;
+
+    for (size_t i = 0; i < count; i++) {
+        if (evs[i].type == WAIT_IPC) {
+            curenv->env_wait_ipc |= 1U << i;
+            curenv->env_wait_from[i] = evs[i].envid;
+        } else if (evs[i].type == WAIT_FUTEX) {
+            futex_queue(curenv, i, keys[i]);
+        } else if (evs[i].type == WAIT_CONSOLE) {
+            curenv->env_wait_cons |= 1U << i;
+        }
+    }
+
+    wait_block(curenv, deadline, timer, true);
+    return 0;
+}
+
+/* Set NUMA memory policy of 'envid'.
+ * 'policy' is one of MPOL_LOCAL, MPOL_INTERLEAVE or MPOL_BIND,
+ * 'nodemask' is a bit mask of nodes the policy applies to
+ * (0 means all nodes, ignored for MPOL_LOCAL).
+ * The policy affects only memory allocated afterwards.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_INVAL if policy is invalid or nodemask contains no existing nodes. */
+static int
+sys_env_set_mempolicy(envid_t envid, int policy, uint32_t nodemask) {
+    struct Env *env = NULL;
+    int res = envid2env(envid, &env, true);
+    if (res < 0) return res;
+
+    if (policy != MPOL_LOCAL && policy != MPOL_INTERLEAVE && policy != MPOL_BIND)
+        return -E_INVAL;
+
+    if (nodemask) {
+        nodemask &= (1U << numa_node_count) - 1;
+        if (!nodemask) return -E_INVAL;
+    }
+
+    env->env_mempolicy = policy;
+    env->env_memnodes = nodemask;
+    env->env_mem_next = 0;
+
+    return 0;
+}
+
+/* Set CPU weight of 'envid'. Runnable environments get CPU time
+ * in proportion to their weights, default weight is SCHED_WEIGHT_DEFAULT.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_INVAL if weight is not within [SCHED_WEIGHT_MIN, SCHED_WEIGHT_MAX]. */
+static int
+sys_env_set_weight(envid_t envid, uint32_t weight) {
+    struct Env *env = NULL;
+    int res = envid2env(envid, &env, true);
+    if (res < 0) return res;
+
+    if (weight < SCHED_WEIGHT_MIN || weight > SCHED_WEIGHT_MAX) return -E_INVAL;
+
+    /* Virtual runtime charged so far is kept */
+    env->env_weight = weight;
+    return 0;
+}
+
+/* Reserve 'runtime' microseconds of CPU time for 'envid' in every
+ * 'period' microseconds, to be used before 'deadline' (equals to period
+ * if 0) from the start of period. Such real-time environments always run
+ * before other ones, in earliest deadline first order. Env that exhausts
+ * its budget is stopped until the next period, sys_yield() completes
+ * current job early. Zero runtime cancels the reservation.
+ * Statistics are kept in env_rt_stats.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_INVAL if parameters are not in SCHED_RT_RUNTIME_MIN_US <=
+ *      runtime <= deadline <= period <= SCHED_RT_PERIOD_MAX_US.
+ *  -E_NO_CPU if reservations of all environments would take
+ *      more than SCHED_RT_UTIL_MAX_PCT of CPU time. */
+static int
+sys_env_set_rt(envid_t envid, uint64_t runtime, uint64_t period, uint64_t deadline) {
+    struct Env *env = NULL;
+    int res = envid2env(envid, &env, true);
+    if (res < 0) return res;
+
+    return sched_set_rt(env, runtime, period, deadline);
+}
+
+/* Take a snapshot of 'envid': its registers and
+ * a copy-on-write image of its memory. Previous snapshot
+ * of the env is dropped. When env takes a snapshot of itself
+ * sys_env_snapshot() returns 1 after the snapshot is restored.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_NO_MEM if there's no memory or free snapshot slots. */
+static int
+sys_env_snapshot(envid_t envid) {
+    struct Env *env = NULL;
+    int res = envid2env(envid, &env, true);
+    if (res < 0) return res;
+
+    res = snapshot_take(env);
+    if (res < 0) return res;
+
+    if (env == curenv) env->env_snapshot->tf.tf_regs.reg_rax = 1;
+    return 0;
+}
+
+/* Revert 'envid' to its snapshot. Only pages modified
+ * since the snapshot was taken (or last restored) are remapped.
+ * If envid is the current env, execution continues from
+ * sys_env_snapshot() call returning 1.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_INVAL if env has no snapshot.
+ *  -E_NO_MEM if there's no memory to restore the snapshot. */
+static int
+sys_env_restore(envid_t envid) {
+    struct Env *env = NULL;
+    int res = envid2env(envid, &env, true);
+    if (res < 0) return res;
+
+    res = snapshot_restore(env);
+    if (res < 0) return res;
+
+    /* Return value goes to restored trapframe */
+    return env == curenv ? env->env_tf.tf_regs.reg_rax : 0;
+}
+
+/* Store up to 'count' extents of mappings of 'envid'
+ * within [start, end) to 'buf', in address order.
+ * Adjacent mappings with equal protection and page class
+ * are merged into single extent, so if buffer is full
+ * next query should start at the end of the last extent.
+ *
+ * Returns number of stored extents on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_INVAL if range is empty or not below MAX_USER_ADDRESS
+ *      or buffer is too large.
+ *  -E_NO_MEM if there's no memory to copy the buffer pages. */
+static int
+sys_region_extents(envid_t envid, uintptr_t start, uintptr_t end, uintptr_t buf, size_t count) {
+    struct Env *env = NULL;
+    int res = envid2env(envid, &env, true);
+    if (res < 0) return res;
+
+    end = MIN(end, MAX_USER_ADDRESS);
+    if (start >= end) return -E_INVAL;
+    if (!count) return 0;
+
+    if (count > MAX_USER_ADDRESS / sizeof(struct MapExtent)) return -E_INVAL;
+    user_mem_assert(curenv, (void *)buf, count * sizeof(struct MapExtent), PROT_W);
+
+    /* Copy-on-write pages of the buffer are copied before the walk,
+     * a page fault while it is in progress would change the tree */
+    for (uintptr_t va = ROUNDDOWN(buf, PAGE_SIZE); va < buf + count * sizeof(struct MapExtent); va += PAGE_SIZE)
+        if (!user_mem_paddr(&curenv->address_space, va)) return -E_NO_MEM;
+
+    return region_extents(&env->address_space, start, end, (struct MapExtent *)buf, count);
+}
+
+/* Registers ring of batched system calls for the current environment.
+ * Queued entries are executed by sys_ring_enter() or when
+ * environment is descheduled (see sysring_drain()).
+ * 'ring' should be page aligned, NULL unregisters the ring.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_INVAL if ring is not page aligned or not below MAX_USER_ADDRESS.
+ * Destroys the environment if ring is not mapped writable. */
+static int
+sys_ring_setup(uintptr_t ring) {
+    if (!ring) {
+        curenv->env_ring = NULL;
+        return 0;
+    }
+
+    if (ring & CLASS_MASK(0) || ring + sizeof(struct SysRing) > MAX_USER_ADDRESS) return -E_INVAL;
+    user_mem_assert(curenv, (void *)ring, sizeof(struct SysRing), PROT_R | PROT_W);
+
+    curenv->env_ring = (struct SysRing *)ring;
     return 0;
 }
 
+/* Executes system calls queued in the ring of the current environment.
+ *
+ * Returns number of executed entries, < 0 on error.  Errors are:
+ *  -E_INVAL if environment has no ring or ring indices are corrupted. */
+static int
+sys_ring_enter(void) {
+    if (!curenv->env_ring) return -E_INVAL;
+    return sysring_drain(curenv);
+}
+
 /*
  * This function return the difference between maximal
  * number of references of regions [addr, addr + size] and [addr2,addr2+size2]
@@ -407,7 +1183,9 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
 
     // LAB 8: Your code here
 
-    switch(syscallno)
+    /* SYS_ipc_send_regs passes receiver in the upper half of syscall
+     * number since all argument registers carry message words */
+    switch((uint32_t)syscallno)
     {
         case SYS_cputs:
             return (uintptr_t) sys_cputs((const char*) a1, (size_t) a2);
@@ -438,8 +1216,48 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
         }
         case SYS_ipc_try_send:
             return (uintptr_t) sys_ipc_try_send((envid_t) a1, (uint32_t) a2, a3, (size_t) a4, (int) a5);
+        case SYS_ipc_send:
+            return (uintptr_t) sys_ipc_send((envid_t) a1, (uint32_t) a2, a3, (size_t) a4, (int) a5);
         case SYS_ipc_recv:
             return (uintptr_t) sys_ipc_recv(a1, a2);
+        case SYS_ipc_call:
+            return (uintptr_t) sys_ipc_call((envid_t) a1, (uint32_t) a2, a3, (size_t) a4, (int) a5);
+        case SYS_ipc_reply_recv:
+            return (uintptr_t) sys_ipc_reply_recv((envid_t) a1, (uint32_t) a2, a3, a4);
+        case SYS_env_set_mempolicy:
+            return (uintptr_t) sys_env_set_mempolicy((envid_t) a1, (int) a2, (uint32_t) a3);
+        case SYS_env_snapshot:
+            return (uintptr_t) sys_env_snapshot((envid_t) a1);
+        case SYS_env_restore:
+            return (uintptr_t) sys_env_restore((envid_t) a1);
+        case SYS_region_extents:
+            return (uintptr_t) sys_region_extents((envid_t) a1, a2, a3, a4, (size_t) a5);
+        case SYS_ring_setup:
+            return (uintptr_t) sys_ring_setup(a1);
+        case SYS_ring_enter:
+            return (uintptr_t) sys_ring_enter();
+        case SYS_map_regions:
+            return (uintptr_t) sys_map_regions((envid_t) a1, (envid_t) a2, a3, (size_t) a4);
+        case SYS_ipc_send_regs: {
+            uint64_t words[IPC_MAX_WORDS] = {a1, a2, a3, a4, a5, a6};
+            return (uintptr_t) sys_ipc_send_regs((envid_t)(syscallno >> 32), words);
+        }
+        case SYS_ipc_recv_regs:
+            return (uintptr_t) sys_ipc_recv_regs();
+        case SYS_ipc_mailbox:
+            return (uintptr_t) sys_ipc_mailbox((size_t) a1, a2, (size_t) a3);
+        case SYS_ipc_recv_batch:
+            return (uintptr_t) sys_ipc_recv_batch(a1, (size_t) a2);
+        case SYS_futex_wait:
+            return (uintptr_t) sys_futex_wait(a1, (uint32_t) a2, a3);
+        case SYS_futex_wake:
+            return (uintptr_t) sys_futex_wake(a1, (int) a2);
+        case SYS_wait:
+            return (uintptr_t) sys_wait(a1, (size_t) a2);
+        case SYS_env_set_weight:
+            return (uintptr_t) sys_env_set_weight((envid_t) a1, (uint32_t) a2);
+        case SYS_env_set_rt:
+            return (uintptr_t) sys_env_set_rt((envid_t) a1, a2, a3, a4);
         default:
             return -E_NO_SYS;
     }
@@ -448,3 +1266,82 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
 
     return -E_NO_SYS;
 }
+
+/* Ring stays usable only while it is mapped writable,
+ * since queued system calls can unmap it */
+static bool
+sysring_valid(struct Env *env) {
+    return !user_mem_check(env, env->env_ring, sizeof(struct SysRing), PROT_R | PROT_W | PROT_USER_);
+}
+
+/* Executes system calls queued in env's ring until either
+ * submission queue is empty or completion queue is full.
+ * Only region management and IPC sends can be batched,
+ * other entries complete with -E_INVAL.
+ * Env should be current and its address space should be active.
+ *
+ * Returns number of executed entries, -E_INVAL if ring indices are corrupted.
+ * Unregisters the ring if it is not mapped anymore. */
+int
+sysring_drain(struct Env *env) {
+    assert(env == curenv && current_space == &env->address_space);
+
+    if (!sysring_valid(env)) {
+        env->env_ring = NULL;
+        return 0;
+    }
+
+    struct SysRing *ring = env->env_ring;
+    uint32_t head = ring->sq_head, tail = ring->sq_tail;
+    if (tail - head > SYSRING_ENTRIES) return -E_INVAL;
+
+    int count = 0;
+    while (head != tail && ring->cq_tail - ring->cq_head < SYSRING_ENTRIES) {
+        struct SysRingEntry sqe = ring->sq[head++ % SYSRING_ENTRIES];
+
+        int64_t res = -E_INVAL;
+        switch (sqe.num) {
+        case SYS_alloc_region:
+        case SYS_map_region:
+        case SYS_unmap_region:
+        case SYS_ipc_try_send:
+            res = syscall(sqe.num, sqe.args[0], sqe.args[1], sqe.args[2],
+                          sqe.args[3], sqe.args[4], sqe.args[5]);
+        }
+        count++;
+
+        if (!sysring_valid(env)) {
+            env->env_ring = NULL;
+            break;
+        }
+
+        ring->cq[ring->cq_tail % SYSRING_ENTRIES] = (struct SysCompletion){sqe.user_data, res};
+        asm volatile("" ::: "memory");
+        ring->cq_tail++;
+        ring->sq_head = head;
+    }
+
+    return count;
+}
+
+/* Called from syscall_entry (kern/trapentry.S) on SYSCALL instruction.
+ * Only callee-saved registers, RIP, RFLAGS and RSP are saved
+ * to curenv->env_tf, so the environment is resumed with SYSRET
+ * unless its trapframe was replaced by the system call
+ * (e.g. sys_env_restore()) or it is not running anymore. */
+struct Trapframe *
+fast_syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
+    assert(curenv && curenv->env_status == ENV_RUNNING);
+    struct Trapframe *tf = &curenv->env_tf;
+    sched_account(curenv);
+
+    tf->tf_regs.reg_rax = syscall(syscallno, a1, a2, a3, a4, a5, a6);
+
+    if (curenv->env_status != ENV_RUNNING || sched_preempt_pending()) sched_yield();
+
+    /* SYSRET to non-canonical RIP faults in kernel mode */
+    if (tf->tf_trapno != T_FASTSYSCALL || tf->tf_rip >= MAX_USER_ADDRESS)
+        env_run(curenv);
+
+    return tf;
+}
@@ -4,8 +4,12 @@
 #error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/env.h>
 #include <inc/syscall.h>
+#include <inc/trap.h>
 
 uintptr_t syscall(uintptr_t num, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6);
+int sysring_drain(struct Env *env);
+struct Trapframe *fast_syscall(uintptr_t num, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6);
 
 #endif /* !JOS_KERN_SYSCALL_H */
@@ -170,6 +170,31 @@ get_hpet(void) {
     return khpet;
 }
 
+/* Obtain and map SRAT ACPI table address
+ * (NULL if firmware does not describe NUMA topology). */
+SRAT *
+get_srat(void) {
+    static SRAT *ksrat = NULL;
+
+    if (ksrat)
+        return ksrat;
+
+    ksrat = (SRAT*) acpi_find_table(SRAT_sign);
+    return ksrat;
+}
+
+/* Obtain and map SLIT ACPI table address. */
+SLIT *
+get_slit(void) {
+    static SLIT *kslit = NULL;
+
+    if (kslit)
+        return kslit;
+
+    kslit = (SLIT*) acpi_find_table(SLIT_sign);
+    return kslit;
+}
+
 RSDP *
 get_rsdp(void) {
 
@@ -385,6 +410,44 @@ hpet_handle_interrupts_tim1(void) {
     pic_send_eoi(IRQ_CLOCK);
 }
 
+static bool hpet_tim1_oneshot;
+
+/* Arm HPET timer 1 to trigger IRQ_CLOCK once after 'ns' nanoseconds
+ * (used by scheduler to enforce real-time budgets, see sched_arm_timer()).
+ * Timer 1 is free only when timer 0 is used for scheduling,
+ * returns false if one-shot timer is not available. */
+bool
+hpet_oneshot_tim1(uint64_t ns) {
+    if (!hpetReg || !timer_for_schedule ||
+        timer_for_schedule->handle_interrupts != hpet_handle_interrupts_tim0) return 0;
+
+    if (!hpet_tim1_oneshot) {
+        uint64_t conf = hpetReg->TIM1_CONF;
+        conf &= ~(HPET_TN_TYPE_CNF | HPET_TN_INT_TYPE_CONF); /* Non-periodic, edge triggered */
+        hpetReg->TIM1_CONF = conf | HPET_TN_INT_ENB_CNF;
+        pic_irq_unmask(IRQ_CLOCK);
+        hpet_tim1_oneshot = 1;
+    }
+
+    /* Comparator fires only on exact match, so it should
+     * still be ahead of main counter after it's written */
+    uint64_t ticks = MAX((uint64_t)((unsigned __int128)ns * hpetFreq / Giga), hpetFreq / (100 * kilo));
+    uint64_t comp;
+    do {
+        comp = hpetReg->MAIN_CNT + ticks;
+        hpetReg->TIM1_COMP = comp;
+        ticks *= 2;
+    } while ((int64_t)(hpetReg->MAIN_CNT - comp) >= 0);
+
+    return 1;
+}
+
+/* IRQ_CLOCK comes from one-shot timer */
+bool
+hpet_oneshot_tim1_enabled(void) {
+    return hpet_tim1_oneshot;
+}
+
 /* Calculate CPU frequency in Hz with the help with HPET timer.
  * HINT Use hpet_get_main_cnt function and do not forget about
  * about pause instruction. */
@@ -180,6 +180,63 @@ typedef struct {
 #define ACPI_FADT_FLAG_TMR_VAL_EXT (1 << 8)
 #define ACPI_PM1A_ST_REG_TMR_STS   (1 << 0)
 
+/* System Resource Affinity Table */
+typedef struct {
+    ACPISDTHeader h;
+    uint32_t TableRevision;
+    uint64_t Reserved;
+    uint8_t Entries[];
+} SRAT;
+
+typedef struct {
+    uint8_t Type;
+    uint8_t Length;
+} SRATEntryHeader;
+
+#define SRAT_TYPE_CPU_AFFINITY    0
+#define SRAT_TYPE_MEMORY_AFFINITY 1
+#define SRAT_TYPE_X2APIC_AFFINITY 2
+
+typedef struct {
+    SRATEntryHeader h;
+    uint8_t ProximityDomainLo;
+    uint8_t ApicId;
+    uint32_t Flags;
+    uint8_t LocalSapicEid;
+    uint8_t ProximityDomainHi[3];
+    uint32_t ClockDomain;
+} SRATCpuAffinity;
+
+typedef struct {
+    SRATEntryHeader h;
+    uint32_t ProximityDomain;
+    uint16_t Reserved1;
+    uint64_t BaseAddress;
+    uint64_t Length;
+    uint32_t Reserved2;
+    uint32_t Flags;
+    uint64_t Reserved3;
+} SRATMemoryAffinity;
+
+typedef struct {
+    SRATEntryHeader h;
+    uint16_t Reserved1;
+    uint32_t ProximityDomain;
+    uint32_t X2ApicId;
+    uint32_t Flags;
+    uint32_t ClockDomain;
+    uint32_t Reserved2;
+} SRATX2ApicAffinity;
+
+#define SRAT_FLAG_ENABLED (1 << 0)
+
+/* System Locality Information Table */
+typedef struct {
+    ACPISDTHeader h;
+    uint64_t LocalityCount;
+    uint8_t Entries[]; /* LocalityCount x LocalityCount distance matrix */
+} SLIT;
+
 #pragma pack(pop)
 
 void acpi_enable(void);
@@ -187,6 +244,8 @@ void acpi_enable(void);
 RSDP *get_rsdp(void);
 FADT *get_fadt(void);
 HPET *get_hpet(void);
+SRAT *get_srat(void);
+SLIT *get_slit(void);
 
 XSDT* get_xsdt(RSDP* rsdp);
 
@@ -194,6 +253,8 @@ static const char RSDP_sign[8] = "RSD PTR ";
 static const char XSDT_sign[4] = "XSDT";
 static const char FADT_sign[4] = "FACP";
 static const char HPET_sign[4] = "HPET";
+static const char SRAT_sign[4] = "SRAT";
+static const char SLIT_sign[4] = "SLIT";
 
 void hpet_print_struct(void);
 void hpet_init(void);
@@ -203,6 +264,8 @@ void hpet_enable_interrupts_tim1(void);
 uint64_t hpet_cpu_frequency(void);
 void hpet_handle_interrupts_tim0(void);
 void hpet_handle_interrupts_tim1(void);
+bool hpet_oneshot_tim1(uint64_t ns);
+bool hpet_oneshot_tim1_enabled(void);
 
 uint32_t pmtimer_get_timeval(void);
 uint64_t pmtimer_cpu_frequency(void);
@@ -14,6 +14,8 @@
 #include <kern/picirq.h>
 #include <kern/timer.h>
 #include <kern/traceopt.h>
+#include <kern/vsyscall.h>
+#include <kern/wait.h>
 
 static struct Taskstate ts;
 
@@ -44,6 +46,7 @@ static struct Taskstate ts;
     extern void simderr_thdlr(void);
 
     extern void syscall_hdlr(void);
+    extern void syscall_entry(void);
 
     extern void clock_thdlr(void);
     extern void timer_thdlr(void);
@@ -85,10 +88,10 @@ struct Segdesc32 gdt[2 * NCPU + 7] = {
         [GD_KT32 >> 3] = SEG32(STA_X | STA_R, 0x0, 0xFFFFFFFF, 0),
         /* 0x20 - kernel data segment 32bit */
         [GD_KD32 >> 3] = SEG32(STA_W, 0x0, 0xFFFFFFFF, 0),
-        /* 0x28 - user code segment */
-        [GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 3),
-        /* 0x30 - user data segment */
+        /* 0x28 - user data segment */
         [GD_UD >> 3] = SEG64(STA_W, 0x0, 0xFFFFFFFF, 3),
+        /* 0x30 - user code segment */
+        [GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 3),
         /* Per-CPU TSS descriptors (starting from GD_TSS0) are initialized
      * in trap_init_percpu() */
         [GD_TSS0 >> 3] = SEG_NULL,
@@ -125,6 +128,7 @@ trapname(int trapno) {
 
     if (trapno < sizeof(excnames) / sizeof(excnames[0])) return excnames[trapno];
     if (trapno == T_SYSCALL) return "System call";
+    if (trapno == T_FASTSYSCALL) return "Fast system call";
     if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16) return "Hardware Interrupt";
 
     return "(unknown trap)";
@@ -234,6 +238,21 @@ trap_init_percpu(void) {
 
     /* Load the IDT */
     lidt(&idt_pd);
+
+#ifndef CONFIG_KSPACE
+    /* Enable SYSCALL/SYSRET fast system call path if supported.
+     * SYSCALL loads CS from STAR[47:32] (SS = CS + 8),
+     * SYSRET loads CS from STAR[63:48] + 16 (SS = STAR[63:48] + 8) */
+    static_assert(GD_UT == GD_UD + 8, "SYSRET requires user text to follow user data");
+    uint32_t features;
+    cpuid(0x80000001, NULL, NULL, NULL, &features);
+    if (features & CPUID_EXT_SYSCALL) {
+        wrmsr(MSR_STAR, (uint64_t)((GD_UD - 8) | 3) << 48 | (uint64_t)GD_KT << 32);
+        wrmsr(MSR_LSTAR, (uintptr_t)syscall_entry);
+        wrmsr(MSR_SFMASK, FL_IF | FL_DF | FL_TF | FL_AC | FL_NT);
+        wrmsr(EFER_MSR, rdmsr(EFER_MSR) | EFER_SCE);
+    }
+#endif
 }
 
 void
@@ -324,8 +343,18 @@ trap_dispatch(struct Trapframe *tf) {
             print_trapframe(tf);
         }
         return;
-    case IRQ_OFFSET + IRQ_TIMER:
     case IRQ_OFFSET + IRQ_CLOCK:
+        if (hpet_oneshot_tim1_enabled()) {
+            /* Real-time budget or period timer (see sched_arm_timer()),
+             * it is not a periodic tick, so the tick work below is
+             * skipped. sched_tick() doesn't return */
+            hpet_handle_interrupts_tim1();
+            sched_tick();
+        }
+        /* Only when IRQ_CLOCK is the periodic tick (one-shot
+         * timer is not in use) */
+        /* fallthrough */
+    case IRQ_OFFSET + IRQ_TIMER:
         // LAB 5: Your code here
         // LAB 4: Your code here
         {
@@ -333,11 +362,14 @@ trap_dispatch(struct Trapframe *tf) {
 
             assert(timer_for_schedule);
             timer_for_schedule->handle_interrupts();
+            vsys_tick();
+            wait_tick();
 
-            // cprintf("trap_dispath(): timer/clock - calling sched_yield()\n");
+            /* Memory of dying environments is released one bounded
+             * step per tick (and in idle loop, see sched_idle()) */
+            env_reclaim();
 
-            sched_yield();  // passing control to the scheduler since 
-                            // we have timer/clocl interrupt
+            sched_tick();
             return;
         }
     default:
@@ -413,14 +445,17 @@ trap(struct Trapframe *tf) {
         }
     }
 
-    assert(curenv);
-
-    /* Copy trap frame (which is currently on the stack)
-     * into 'curenv->env_tf', so that running the environment
-     * will restart at the trap point */
-    curenv->env_tf = *tf;
-    /* The trapframe on the stack should be ignored from here on */
-    tf = &curenv->env_tf;
+    /* Interrupts can also arrive in kernel mode while
+     * CPU is idle (see sched_halt()), curenv is NULL then */
+    if (curenv) {
+        /* Copy trap frame (which is currently on the stack)
+         * into 'curenv->env_tf', so that running the environment
+         * will restart at the trap point */
+        curenv->env_tf = *tf;
+        sched_account(curenv);
+        /* The trapframe on the stack should be ignored from here on */
+        tf = &curenv->env_tf;
+    }
 
     /* Record that tf is the last real trapframe so
      * print_trapframe can print some additional information */
@@ -432,7 +467,7 @@ trap(struct Trapframe *tf) {
     /* If we made it to this point, then no other environment was
      * scheduled, so we should return to the current environment
      * if doing so makes sense */
-    if (curenv && curenv->env_status == ENV_RUNNING)
+    if (curenv && curenv->env_status == ENV_RUNNING && !sched_preempt_pending())
     {
         // cprintf("end of trap(), env_run called \n");
         env_run(curenv);
@@ -0,0 +1,55 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/tsc.h>
+#include <kern/vsyscall.h>
+
+/* Kernel writable view of the page mapped at UVSYS */
+volatile struct VSysPage *vsys;
+
+/* Fixed point shift for TSC to nanoseconds conversion.
+ * 10^9 << 32 still fits in 64 bits */
+#define VSYS_TSC_SHIFT 32
+
+void
+vsys_init(void) {
+    static_assert(sizeof(struct VSysPage) <= UVSYS_SIZE, "VSysPage does not fit into UVSYS");
+
+    vsys = kzalloc_region(UVSYS_SIZE);
+    assert(vsys);
+
+    /* UVSYS is in kernel part of the address space
+     * and becomes visible to all environments at once */
+    int res = map_region(&kspace, UVSYS, &kspace, (uintptr_t)vsys, UVSYS_SIZE, PROT_R | PROT_USER_);
+    if (res < 0) panic("vsys_init: %i\n", res);
+
+    uint64_t freq = tsc_calibrate();
+    assert(freq);
+
+    vsys->tsc_shift = VSYS_TSC_SHIFT;
+    vsys->tsc_mult = (1000000000ULL << VSYS_TSC_SHIFT) / freq;
+    vsys->tsc_base = read_tsc();
+}
+
+/* Called on context switch to 'env' */
+void
+vsys_switch(struct Env *env) {
+    vsys->envid = env->env_id;
+    vsys->env_runs = env->env_runs;
+}
+
+/* Nanoseconds since boot, same clock as user vsys_gettime() */
+uint64_t
+vsys_now(void) {
+    uint64_t delta = read_tsc() - vsys->tsc_base;
+    return (uint64_t)(((unsigned __int128)delta * vsys->tsc_mult) >> vsys->tsc_shift);
+}
+
+void
+vsys_tick(void) {
+    vsys->ticks++;
+}
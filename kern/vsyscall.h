@@ -0,0 +1,19 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VSYSCALL_H
+#define JOS_KERN_VSYSCALL_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+#include <inc/vsyscall.h>
+
+extern volatile struct VSysPage *vsys;
+
+void vsys_init(void);
+void vsys_switch(struct Env *env);
+void vsys_tick(void);
+uint64_t vsys_now(void);
+
+#endif /* !JOS_KERN_VSYSCALL_H */
@@ -0,0 +1,121 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/console.h>
+#include <kern/env.h>
+#include <kern/futex.h>
+#include <kern/vsyscall.h>
+#include <kern/wait.h>
+
+/*
+ * Blocking on sets of events (sys_futex_wait, sys_wait).
+ *
+ * Sources of events register the environment themselves:
+ * futex words are queued with futex_queue(), IPC and console
+ * events are masks in the Env. Whichever source fires first
+ * calls wait_wake() with the events that became ready, which
+ * removes the environment from all other sources.
+ *
+ * Waiters with a timeout are kept in a list sorted by deadline
+ * which is checked on every timer interrupt. There is no console
+ * input interrupt, so console waiters are polled at the same time.
+ */
+
+static struct Env *wait_timed;
+static size_t wait_cons_waiters;
+
+/* Blocks env until wait_wake(). Futex and IPC/console events
+ * should already be registered. 'timer' is the set of events
+ * firing at 'deadline' (ns since boot, 0 means no timeout).
+ * With 'set' the ready set of events is returned to env,
+ * otherwise 0 on wakeup and -E_TIMEOUT on timeout. */
+void
+wait_block(struct Env *env, uint64_t deadline, uint32_t timer, bool set) {
+    assert(!env->env_waiting);
+
+    env->env_waiting = true;
+    env->env_wait_set = set;
+    env->env_wait_timer = timer;
+    env->env_wait_deadline = deadline;
+    if (deadline) {
+        struct Env **link = &wait_timed;
+        while (*link && (*link)->env_wait_deadline <= deadline)
+            link = &(*link)->env_wait_timed_next;
+        env->env_wait_timed_next = *link;
+        *link = env;
+    }
+    if (env->env_wait_cons) wait_cons_waiters++;
+
+    env->env_tf.tf_regs.reg_rax = 0;
+    env_sleep(env);
+}
+
+/* Removes env from all event sources without waking it up */
+void
+wait_cancel(struct Env *env) {
+    if (!env->env_waiting) return;
+
+    futex_dequeue(env);
+
+    if (env->env_wait_deadline) {
+        struct Env **link = &wait_timed;
+        for (; *link != env; link = &(*link)->env_wait_timed_next)
+            assert(*link);
+        *link = env->env_wait_timed_next;
+        env->env_wait_timed_next = NULL;
+        env->env_wait_deadline = 0;
+    }
+
+    if (env->env_wait_cons) wait_cons_waiters--;
+
+    env->env_wait_ipc = env->env_wait_cons = env->env_wait_timer = 0;
+    env->env_waiting = false;
+}
+
+/* Makes env runnable reporting 'ready' events */
+void
+wait_wake(struct Env *env, uint32_t ready) {
+    if (!env->env_waiting) return;
+
+    bool set = env->env_wait_set;
+    wait_cancel(env);
+
+    env->env_tf.tf_regs.reg_rax = set ? ready : ready ? 0 : -E_TIMEOUT;
+    env_set_status(env, ENV_RUNNABLE);
+}
+
+/* Called when message from 'from' is queued for target */
+void
+wait_ipc_notify(struct Env *target, envid_t from) {
+    uint32_t ready = 0;
+    for (size_t i = 0; i < WAIT_MAX_EVENTS; i++) {
+        if (target->env_wait_ipc & (1U << i) &&
+            (!target->env_wait_from[i] || target->env_wait_from[i] == from))
+            ready |= 1U << i;
+    }
+    if (ready) wait_wake(target, ready);
+}
+
+/* Called on timer interrupt, wakes waiters whose
+ * timeout expired and console waiters if there is input */
+void
+wait_tick(void) {
+    if (wait_timed) {
+        uint64_t now = vsys_now();
+        while (wait_timed && wait_timed->env_wait_deadline <= now)
+            wait_wake(wait_timed, wait_timed->env_wait_timer);
+    }
+
+    if (wait_cons_waiters && cons_pending()) {
+        for (size_t i = 0; i < NENV; i++)
+            if (envs[i].env_wait_cons) wait_wake(&envs[i], envs[i].env_wait_cons);
+    }
+}
+
+/* There are waiters that will be woken up by timer */
+bool
+wait_tick_pending(void) {
+    return wait_timed || wait_cons_waiters;
+}
@@ -0,0 +1,19 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_WAIT_H
+#define JOS_KERN_WAIT_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+void wait_block(struct Env *env, uint64_t deadline, uint32_t timer, bool set);
+void wait_wake(struct Env *env, uint32_t ready);
+void wait_cancel(struct Env *env);
+void wait_ipc_notify(struct Env *target, envid_t from);
+void wait_tick(void);
+bool wait_tick_pending(void);
+
+#endif /* !JOS_KERN_WAIT_H */
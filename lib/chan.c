@@ -0,0 +1,107 @@
+/* Single-producer/single-consumer channels over shared memory.
+ *
+ * Data goes through a ring in a PROT_SHARE region (shared with the peer
+ * by fork() or sys_map_region()), so no system call is made while the
+ * ring is neither empty nor full. A side that finds the ring empty (full)
+ * raises its waiting flag and sleeps, the peer rings a doorbell only
+ * when it sees the flag after making the ring non-empty (not full).
+ * Doorbells are sent with sys_ipc_try_send() into the sleeper's mailbox
+ * (see sys_ipc_mailbox()), so they are not lost while it is not blocked
+ * yet. Envs using channels should not use their mailbox for anything else. */
+
+#include <inc/lib.h>
+
+/* Flag store should be visible before the ring is checked again
+ * and the ring update should be visible before the flag is checked */
+static inline void
+chan_fence(void) {
+    asm volatile("mfence" ::: "memory");
+}
+
+/* Allocates zeroed channel at page aligned 'ch' */
+int
+chan_create(struct Chan *ch) {
+    return sys_alloc_region(CURENVID, ch, ROUNDUP(sizeof(*ch), PAGE_SIZE), PROT_RW | PROT_SHARE);
+}
+
+void
+chan_destroy(struct Chan *ch) {
+    sys_unmap_region(CURENVID, ch, ROUNDUP(sizeof(*ch), PAGE_SIZE));
+}
+
+static void
+chan_ring(envid_t peer) {
+    int res = sys_ipc_try_send(peer, 0, (void *)(MAX_USER_ADDRESS + 1), 0, 0);
+    /* Full mailbox already has a doorbell, dead peer cannot be woken */
+    if (res < 0 && res != -E_MAILBOX_FULL && res != -E_BAD_ENV)
+        panic("chan_ring: %i", res);
+}
+
+/* Mailbox should exist before waiting flag is raised
+ * since the peer rings the doorbell as soon as it sees the flag */
+static void
+chan_prepare_wait(void) {
+    if (thisenv->env_mbox_depth) return;
+
+    int res = sys_ipc_mailbox(CHAN_DOORBELLS, (void *)MAX_USER_ADDRESS, 0);
+    if (res < 0) panic("sys_ipc_mailbox: %i", res);
+}
+
+/* Sleeps until a doorbell arrives, drops all pending doorbells */
+static void
+chan_wait(void) {
+    struct IpcMessage msgs[CHAN_DOORBELLS];
+    ipc_recv_batch(msgs, CHAN_DOORBELLS);
+}
+
+void
+chan_send(struct Chan *ch, uint64_t value) {
+    if (ch->prod != thisenv->env_id) ch->prod = thisenv->env_id;
+
+    uint32_t tail = ch->tail;
+    while (tail - ch->head == CHAN_SLOTS) {
+        chan_prepare_wait();
+        ch->prod_waiting = 1;
+        chan_fence();
+        if (tail - ch->head == CHAN_SLOTS) chan_wait();
+        ch->prod_waiting = 0;
+    }
+
+    ch->data[tail % CHAN_SLOTS] = value;
+    /* Slot should be written before the tail moves */
+    asm volatile("" ::: "memory");
+    ch->tail = tail + 1;
+
+    chan_fence();
+    if (ch->cons_waiting) {
+        ch->cons_waiting = 0;
+        chan_ring(ch->cons);
+    }
+}
+
+uint64_t
+chan_recv(struct Chan *ch) {
+    if (ch->cons != thisenv->env_id) ch->cons = thisenv->env_id;
+
+    uint32_t head = ch->head;
+    while (ch->tail == head) {
+        chan_prepare_wait();
+        ch->cons_waiting = 1;
+        chan_fence();
+        if (ch->tail == head) chan_wait();
+        ch->cons_waiting = 0;
+    }
+
+    uint64_t value = ch->data[head % CHAN_SLOTS];
+    /* Slot should be read before it is released */
+    asm volatile("" ::: "memory");
+    ch->head = head + 1;
+
+    chan_fence();
+    if (ch->prod_waiting) {
+        ch->prod_waiting = 0;
+        chan_ring(ch->prod);
+    }
+
+    return value;
+}
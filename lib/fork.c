@@ -24,7 +24,7 @@ fork(void) {
         panic("sys_exofork: %i", envid);
     if (envid == 0)
     {
-        thisenv = &envs[ENVX(sys_getenvid())];
+        thisenv = &envs[ENVX(vsys_getenvid())];
         return 0;
     }
 
@@ -45,7 +45,86 @@ fork(void) {
     return envid;
 }
 
+/* Number of extents sfork() looks up at once */
+#define SFORK_EXTENTS 32
+
+/* Makes [start, end) of our address space shared and maps it to envid.
+ * Shared pages cannot be lazy, so copy-on-write and not yet allocated
+ * pages get private copies first, which also breaks sharing with
+ * children created by fork() earlier. Pages stay shared with children
+ * created by fork() later. */
+static int
+share_region(envid_t envid, uintptr_t start, uintptr_t end) {
+    struct MapExtent ext[SFORK_EXTENTS];
+
+    while (start < end) {
+        int n = sys_region_extents(0, (void *)start, (void *)end, ext, SFORK_EXTENTS);
+        if (n <= 0) return n;
+
+        for (int i = 0; i < n; i++) {
+            void *va = (void *)ext[i].start;
+            int perm = (ext[i].prot & (PROT_ALL | PROT_AVAIL)) | PROT_SHARE;
+
+            /* First remapping of a lazy page only allocates the copy */
+            int res = 0;
+            if (ext[i].prot & PROT_LAZY)
+                res = sys_map_region(0, va, 0, va, ext[i].size, perm);
+            if (!res && !(ext[i].prot & PROT_SHARE))
+                res = sys_map_region(0, va, 0, va, ext[i].size, perm);
+            if (!res)
+                res = sys_map_region(0, va, envid, va, ext[i].size, perm);
+            if (res < 0) return res;
+        }
+
+        start = ext[n - 1].start + ext[n - 1].size;
+    }
+
+    return 0;
+}
+
+/* Shared-memory fork.
+ * Create a child that shares our whole address space except
+ * the stacks and thread-local storage (everything from USER_TLS up),
+ * which are lazily copied like in fork(). thisenv and values of
+ * tls_key_create() keys are per environment.
+ * Memory mapped after sfork() returns is not shared.
+ *
+ * Returns: child's envid to the parent, 0 to the child, < 0 on error.
+ * It is also OK to panic on error. */
 envid_t
-sfork() {
-    panic("sfork() is not implemented");
+sfork(void) {
+    envid_t envid = sys_exofork();
+    if (envid < 0)
+        panic("sys_exofork: %i", envid);
+    if (envid == 0) {
+        thisenv = &envs[ENVX(vsys_getenvid())];
+        return 0;
+    }
+
+#ifdef SANITIZE_USER_SHADOW_BASE
+    /* Shadow memory is huge and mostly unallocated, keep it private */
+    int res = share_region(envid, 0, SANITIZE_USER_SHADOW_BASE);
+    if (!res) res = sys_map_region(0, (void *)SANITIZE_USER_SHADOW_BASE, envid, (void *)SANITIZE_USER_SHADOW_BASE,
+                                   SANITIZE_USER_SHADOW_SIZE, PROT_ALL | PROT_LAZY | PROT_COMBINE);
+    if (!res) res = share_region(envid, SANITIZE_USER_SHADOW_BASE + SANITIZE_USER_SHADOW_SIZE, USER_TLS);
+#else
+    int res = share_region(envid, 0, USER_TLS);
+#endif
+    if (res < 0)
+        panic("sfork: %i", res);
+
+    res = sys_map_region(0, (void *)USER_TLS, envid, (void *)USER_TLS,
+                         MAX_USER_ADDRESS - USER_TLS, PROT_ALL | PROT_LAZY | PROT_COMBINE);
+    if (res < 0)
+        panic("sys_map_region: %i", res);
+
+    res = sys_env_set_pgfault_upcall(envid, thisenv->env_pgfault_upcall);
+    if (res < 0)
+        panic("sys_env_set_pgfault_upcall: %i", res);
+
+    res = sys_env_set_status(envid, ENV_RUNNABLE);
+    if (res < 0)
+        panic("sys_env_set_status: %i", res);
+
+    return envid;
 }
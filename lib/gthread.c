@@ -0,0 +1,208 @@
+/* Cooperative green threads running inside one environment */
+
+#include <inc/lib.h>
+
+enum {
+    GTHREAD_FREE = 0,
+    GTHREAD_RUNNABLE,
+    GTHREAD_RUNNING,
+    GTHREAD_BLOCKED,
+};
+
+struct GThread {
+    struct GContext ctx;
+    struct GThread *next; /* Next thread in the same queue */
+    int state;
+    bool stack;           /* Stack is allocated */
+};
+
+void gthread_switch(struct GContext *from, struct GContext *to);
+void gthread_trampoline(void);
+
+static_assert(offsetof(struct GContext, mxcsr) == 56 && offsetof(struct GContext, fpucw) == 60,
+              "struct GContext layout is hardcoded in gswitch.S");
+
+/* Thread 0 is the initial context of the environment.
+ * State is global, so environments created by sfork()
+ * cannot both use green threads. */
+static struct GThread threads[GTHREAD_MAX] = {[0] = {.state = GTHREAD_RUNNING}};
+static struct GThread *current = &threads[0];
+static struct GQueue runq;
+static struct GQueue ipc_waiters; /* Parked in ipc_recv() */
+static struct GThread *joiner;    /* Waiting in gthread_wait_all() */
+static int nthreads = 1;
+
+static void
+gq_push(struct GQueue *q, struct GThread *t) {
+    t->next = NULL;
+    if (q->tail)
+        q->tail->next = t;
+    else
+        q->head = t;
+    q->tail = t;
+}
+
+static struct GThread *
+gq_pop(struct GQueue *q) {
+    struct GThread *t = q->head;
+    if (t) {
+        q->head = t->next;
+        if (!q->head) q->tail = NULL;
+        t->next = NULL;
+    }
+    return t;
+}
+
+static void
+wake(struct GThread *t) {
+    t->state = GTHREAD_RUNNABLE;
+    gq_push(&runq, t);
+}
+
+/* Message for threads parked in ipc_recv() is pending */
+static bool
+ipc_pending(void) {
+    /* Expired timer makes sys_wait() a non-blocking poll */
+    static const struct WaitEvent events[] = {{.type = WAIT_IPC}, {.type = WAIT_TIMER}};
+    return sys_wait(events, 2) & 1;
+}
+
+/* Switches to the next runnable thread, current thread
+ * should already be queued somewhere unless it exits */
+static void
+schedule(void) {
+    if (ipc_waiters.head && runq.head && ipc_pending())
+        wake(gq_pop(&ipc_waiters));
+
+    struct GThread *next = gq_pop(&runq);
+    /* Nothing else to run, so the receiver can block in the kernel */
+    if (!next) next = gq_pop(&ipc_waiters);
+    if (!next) panic("all green threads are blocked");
+
+    struct GThread *prev = current;
+    next->state = GTHREAD_RUNNING;
+    current = next;
+    if (next != prev) gthread_switch(&prev->ctx, &next->ctx);
+}
+
+static void
+block(struct GQueue *q) {
+    current->state = GTHREAD_BLOCKED;
+    gq_push(q, current);
+    schedule();
+}
+
+/* Creates runnable thread calling fn(arg), the thread
+ * exits when fn returns.
+ * Returns thread id, < 0 on error.  Errors are:
+ *  -E_NO_MEM if there are GTHREAD_MAX threads already
+ *      or stack cannot be allocated. */
+int
+gthread_create(void (*fn)(void *), void *arg) {
+    struct GThread *t = NULL;
+    for (size_t i = 1; i < GTHREAD_MAX && !t; i++)
+        if (threads[i].state == GTHREAD_FREE) t = &threads[i];
+    if (!t) return -E_NO_MEM;
+
+    /* Stacks are kept for reuse after thread exits */
+    uintptr_t stack = GTHREAD_STACKS + (t - threads) * (GTHREAD_STACK_SIZE + PAGE_SIZE);
+    if (!t->stack) {
+        int res = sys_alloc_region(CURENVID, (void *)stack, GTHREAD_STACK_SIZE, PROT_RW);
+        if (res < 0) return res;
+        t->stack = true;
+    }
+
+    /* Return address for the first switch, stack
+     * is 16-byte aligned after it is popped */
+    uint64_t *sp = (uint64_t *)(stack + GTHREAD_STACK_SIZE) - 1;
+    *sp = (uint64_t)gthread_trampoline;
+
+    t->ctx = (struct GContext){
+            .rsp = (uint64_t)sp,
+            .r12 = (uint64_t)fn,
+            .r13 = (uint64_t)arg,
+            .mxcsr = 0x1F80,
+            .fpucw = 0x37F,
+    };
+
+    nthreads++;
+    wake(t);
+    return t - threads;
+}
+
+void
+gthread_yield(void) {
+    current->state = GTHREAD_RUNNABLE;
+    gq_push(&runq, current);
+    schedule();
+}
+
+/* Exiting the initial thread exits the environment */
+void
+gthread_exit(void) {
+    if (current == &threads[0]) {
+        exit();
+        panic("exit() returned");
+    }
+
+    current->state = GTHREAD_FREE;
+    if (--nthreads == 1 && joiner) {
+        wake(joiner);
+        joiner = NULL;
+    }
+
+    schedule();
+    panic("exited thread was resumed");
+}
+
+/* Blocks the initial thread until all other threads exit */
+void
+gthread_wait_all(void) {
+    assert(current == &threads[0]);
+    if (nthreads == 1) return;
+
+    current->state = GTHREAD_BLOCKED;
+    joiner = current;
+    schedule();
+}
+
+int
+gthread_self(void) {
+    return current - threads;
+}
+
+/* Called by ipc_recv() before it blocks in the kernel, so only the
+ * calling thread waits for the message. Other threads run until none
+ * of them is runnable or a message arrives. */
+void
+gthread_park_ipc(void) {
+    if (nthreads > 1) block(&ipc_waiters);
+}
+
+void
+gchan_init(struct GChan *ch) {
+    memset(ch, 0, sizeof(*ch));
+}
+
+/* Blocks current thread while the channel is full */
+void
+gchan_send(struct GChan *ch, uint64_t value) {
+    while (ch->tail - ch->head == GCHAN_SLOTS) block(&ch->senders);
+
+    ch->data[ch->tail++ % GCHAN_SLOTS] = value;
+
+    struct GThread *t = gq_pop(&ch->receivers);
+    if (t) wake(t);
+}
+
+/* Blocks current thread while the channel is empty */
+uint64_t
+gchan_recv(struct GChan *ch) {
+    while (ch->tail == ch->head) block(&ch->receivers);
+
+    uint64_t value = ch->data[ch->head++ % GCHAN_SLOTS];
+
+    struct GThread *t = gq_pop(&ch->senders);
+    if (t) wake(t);
+    return value;
+}
@@ -2,6 +2,33 @@
 
 #include <inc/lib.h>
 
+/* Fills output parameters of ipc_recv() after system call returned 'res' */
+static int32_t
+ipc_recv_result(int res, envid_t *from_env_store, size_t *size, int *perm_store) {
+    if (res < 0)
+    {
+        if (from_env_store != NULL)
+            *from_env_store = 0;
+        if (perm_store != NULL)
+            *perm_store = 0;
+        if (size != NULL)
+            *size = 0;
+
+        return res;
+    }
+    else 
+    {
+        if (from_env_store != NULL)
+            *from_env_store = thisenv->env_ipc_from;
+        if (perm_store != NULL)
+            *perm_store = thisenv->env_ipc_perm;
+        if (size != NULL)
+            *size = thisenv->env_ipc_maxsz;
+    
+        return thisenv->env_ipc_value;
+    }
+}
+
 /* Receive a value via IPC and return it.
  * If 'pg' is nonnull, then any page sent by the sender will be mapped at
  *    that address.
@@ -27,37 +54,16 @@ ipc_recv(envid_t *from_env_store, void *pg, size_t *size, int *perm_store) {
         pg = (void*) (MAX_USER_ADDRESS + 1);
     size_t sz = (size == NULL)? PAGE_SIZE : *size;
 
-    int res = sys_ipc_recv(pg, sz);
-    if (res < 0)
-    {
-        if (from_env_store != NULL)
-            *from_env_store = 0;
-        if (perm_store != NULL)
-            *perm_store = 0;
-        if (size != NULL)
-            *size = 0;
-
-        return res;
-    }
-    else 
-    {
-        if (from_env_store != NULL)
-            *from_env_store = thisenv->env_ipc_from;
-        if (perm_store != NULL)
-            *perm_store = thisenv->env_ipc_perm;
-        if (size != NULL)
-            *size = thisenv->env_ipc_maxsz;
-    
-        return thisenv->env_ipc_value;
-    }
+    /* Only the calling green thread waits */
+    gthread_park_ipc();
+    return ipc_recv_result(sys_ipc_recv(pg, sz), from_env_store, size, perm_store);
 }
 
 /* Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
- * This function keeps trying until it succeeds.
- * It should panic() on any error other than -E_IPC_NOT_RECV.
+ * This function blocks in the kernel until the receiver takes the message.
+ * It should panic() on any error.
  *
  * Hint:
- *   Use sys_yield() to be CPU-friendly.
  *   If 'pg' is null, pass sys_ipc_recv a value that it will understand
  *   as meaning "no page".  (Zero is not the right value.) */
 void
@@ -67,15 +73,79 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, size_t size, int perm) {
     if (pg == NULL)
         pg = (void*) (MAX_USER_ADDRESS + 1);
 
-    int res = 0;
+    int res = sys_ipc_send(to_env, val, pg, size, perm);
+    if (res < 0)
+        panic("ipc_send: %i", res);
+}
 
-    while ((res = sys_ipc_try_send(to_env, val, pg, size, perm)) != 0)
-    {
-        if (res != -E_IPC_NOT_RECV)
-            panic("ipc_send: %i", res);
+/* Send 'value' (and 'pg' region, if 'pg' is nonnull) to 'to_env'
+ * and wait for its reply sent with ipc_reply_and_recv().
+ * Control is passed to 'to_env' directly if it waits for a message.
+ * Returns the reply value, panics on error. */
+int32_t
+ipc_call(envid_t to_env, uint32_t value, void *pg, size_t size, int perm) {
+    if (pg == NULL)
+        pg = (void *)(MAX_USER_ADDRESS + 1);
 
-        sys_yield();
-    }
+    int res = sys_ipc_call(to_env, value, pg, size, perm);
+    if (res < 0)
+        panic("ipc_call: %i", res);
+
+    return thisenv->env_ipc_value;
+}
+
+/* Reply 'value' to 'to_env' blocked in ipc_call() and receive the next
+ * message like ipc_recv(). Control is passed to 'to_env' directly
+ * if there are no pending messages. With to_env == 0 it is ipc_recv(). */
+int32_t
+ipc_reply_and_recv(envid_t to_env, uint32_t value, envid_t *from_env_store,
+                   void *pg, size_t *size, int *perm_store) {
+    if (pg == NULL)
+        pg = (void *)(MAX_USER_ADDRESS + 1);
+    size_t sz = (size == NULL)? PAGE_SIZE : *size;
+
+    return ipc_recv_result(sys_ipc_reply_recv(to_env, value, pg, sz), from_env_store, size, perm_store);
+}
+
+/* Send 'count' (up to IPC_MAX_WORDS) 64-bit words to 'to_env' in registers,
+ * missing words are sent as 0. Blocks like ipc_send(), panics on error.
+ * Receiver of ipc_recv() gets the low 32 bits of words[0] as the value. */
+void
+ipc_send_words(envid_t to_env, const uint64_t *words, size_t count) {
+    uint64_t msg[IPC_MAX_WORDS] = {0};
+    assert(count <= IPC_MAX_WORDS);
+    memcpy(msg, words, count * sizeof(*words));
+
+    int res = sys_ipc_send_regs(to_env, msg);
+    if (res < 0)
+        panic("ipc_send_words: %i", res);
+}
+
+/* Receive IPC_MAX_WORDS words sent with ipc_send_words() into 'words'.
+ * Message sent with ipc_send() is received as its value in words[0]
+ * (region is not mapped), other words are 0.
+ * If 'from_env_store' is nonnull, then store the sender's envid in it.
+ * Returns 0 on success, < 0 on error. */
+int
+ipc_recv_words(envid_t *from_env_store, uint64_t words[IPC_MAX_WORDS]) {
+    gthread_park_ipc();
+    int res = sys_ipc_recv_regs(words);
+    if (from_env_store != NULL)
+        *from_env_store = res < 0 ? 0 : thisenv->env_ipc_from;
+    return res;
+}
+
+/* Receive up to 'count' messages from the mailbox set up
+ * with sys_ipc_mailbox(), waiting until there is at least one.
+ * Returns number of messages received, panics on error. */
+size_t
+ipc_recv_batch(struct IpcMessage *buf, size_t count) {
+    int res;
+    while (!(res = sys_ipc_recv_batch(buf, count))) ;
+    if (res < 0)
+        panic("ipc_recv_batch: %i", res);
+
+    return res;
 }
 
 /* Find the first environment of the given type.  We'll use this to
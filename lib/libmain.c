@@ -6,7 +6,9 @@
 
 extern void umain(int argc, char **argv);
 
+#ifdef JOS_PROG
 const volatile struct Env *thisenv;
+#endif
 const char *binaryname = "<unknown>";
 
 #ifdef JOS_PROG
@@ -24,7 +26,7 @@ libmain(int argc, char **argv) {
     /* Set thisenv to point at our Env structure in envs[]. */
     // LAB 8: Your code here
 
-    thisenv = &envs[ENVX(sys_getenvid())];
+    thisenv = &envs[ENVX(vsys_getenvid())];
 
     /* Save the name of the program so that panic() can use it */
     if (argc > 0) binaryname = argv[0];
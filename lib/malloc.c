@@ -0,0 +1,345 @@
+/* User heap allocator.
+ *
+ * The heap is a virtual range reserved at MALLOC_BASE, memory is
+ * allocated with sys_alloc_region() which maps zero pages lazily,
+ * so physical memory is committed when it is touched.
+ *
+ * Small objects (up to MALLOC_SMALL_MAX) are rounded up to one of
+ * MALLOC_CLASSES size classes and carved from MALLOC_SLAB_SIZE slabs
+ * in the lower half of the range, the slab header is found by rounding
+ * object address down. Freed objects go back to their slab, pages of
+ * empty slabs are unmapped.
+ *
+ * Large objects get their own pages in the upper half of the range
+ * and are unmapped on free.
+ *
+ * The heap belongs to the address space and is used by a single
+ * environment: children created by fork() get a copy of it, but
+ * environments created by sfork() must not use malloc(), since memory
+ * mapped after sfork() is not shared between them while the heap
+ * metadata is. So there is no locking.
+ */
+
+#include <inc/lib.h>
+
+#define MALLOC_SLAB_SIZE  (16 * PAGE_SIZE)
+#define MALLOC_SMALL_MAX  16384
+#define MALLOC_CLASSES    36
+#define MALLOC_ALIGN      16
+#define MALLOC_LARGE_FREE 64    /* Free large ranges remembered for reuse */
+
+#define SLAB_AREA   MALLOC_BASE
+#define LARGE_AREA  (MALLOC_BASE + MALLOC_SIZE / 2)
+#define LARGE_MAGIC 0x4C41524745484452ULL
+
+#ifdef SANITIZE_USER_SHADOW_BASE
+#define NOSAN __attribute__((no_sanitize_address))
+/* Copies whole chunk including redzone */
+#define chunk_copy(dst, src, size)  __nosan_memcpy((dst), (src), (size))
+#define asan_malloc(p, size, chunk) platform_asan_malloc((p), (size), (chunk))
+#define asan_free(p, chunk)         platform_asan_free((p), (chunk))
+#else
+#define NOSAN
+#define chunk_copy(dst, src, size)  memcpy((dst), (src), (size))
+#define asan_malloc(p, size, chunk) ((void)0)
+#define asan_free(p, chunk)         ((void)0)
+#endif
+
+struct Slab {
+    struct Slab *next, *prev; /* Links in list of partial slabs */
+    void *free;               /* Freed objects */
+    uint32_t class;
+    uint32_t used;   /* Allocated objects */
+    uint32_t carved; /* Objects ever used, the rest was never touched */
+    uint32_t nobjs;
+};
+
+#define SLAB_HEADER ROUNDUP(sizeof(struct Slab), MALLOC_ALIGN)
+
+struct LargeHeader {
+    size_t size; /* Size of mapping including header */
+    uint64_t magic;
+};
+
+#define LARGE_HEADER ROUNDUP(sizeof(struct LargeHeader), MALLOC_ALIGN)
+
+static struct Slab *partial[MALLOC_CLASSES];
+static struct Slab *free_slabs; /* Slabs with unmapped pages */
+static uintptr_t slab_top = SLAB_AREA;
+static uintptr_t large_top = LARGE_AREA;
+static struct {
+    uintptr_t va;
+    size_t size;
+} large_free[MALLOC_LARGE_FREE];
+static struct MallocStats stats;
+
+/* Classes are multiples of 16 up to 128, then
+ * every power of two range is split into 4 classes */
+static size_t
+class_size(int class) {
+    if (class < 8) return (class + 1) * 16;
+    return (size_t)((class - 8) % 4 + 5) << ((class - 8) / 4 + 5);
+}
+
+static int
+size_class(size_t size) {
+    if (size <= 128) return (size + 15) / 16 - 1;
+    int bits = 63 - __builtin_clzl(size - 1);
+    return 8 + (bits - 7) * 4 + (int)((size - 1) >> (bits - 2)) - 4;
+}
+
+/* Freed objects are linked through their first word,
+ * which is poisoned with ASAN enabled */
+static NOSAN void *
+obj_next(void *obj) {
+    return *(void **)obj;
+}
+
+static NOSAN void
+obj_set_next(void *obj, void *next) {
+    *(void **)obj = next;
+}
+
+static void
+partial_push(struct Slab *slab) {
+    slab->prev = NULL;
+    slab->next = partial[slab->class];
+    if (slab->next) slab->next->prev = slab;
+    partial[slab->class] = slab;
+}
+
+static void
+partial_remove(struct Slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        partial[slab->class] = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static bool
+slab_full(struct Slab *slab) {
+    return !slab->free && slab->carved == slab->nobjs;
+}
+
+/* Header stays in the first page which is never unmapped */
+static struct Slab *
+slab_create(int class) {
+    struct Slab *slab = free_slabs;
+    int res;
+    if (slab) {
+        res = sys_alloc_region(CURENVID, (uint8_t *)slab + PAGE_SIZE, MALLOC_SLAB_SIZE - PAGE_SIZE, PROT_RW);
+        if (res < 0) return NULL;
+        free_slabs = slab->next;
+    } else {
+        if (slab_top == LARGE_AREA) return NULL;
+        res = sys_alloc_region(CURENVID, (void *)slab_top, MALLOC_SLAB_SIZE, PROT_RW);
+        if (res < 0) return NULL;
+        slab = (struct Slab *)slab_top;
+        slab_top += MALLOC_SLAB_SIZE;
+    }
+
+    size_t size = class_size(class);
+    slab->free = NULL;
+    slab->class = class;
+    slab->used = slab->carved = 0;
+    slab->nobjs = (MALLOC_SLAB_SIZE - SLAB_HEADER) / size;
+    asan_free((uint8_t *)slab + SLAB_HEADER, slab->nobjs * size);
+
+    partial_push(slab);
+    stats.slabs++;
+    return slab;
+}
+
+static void
+slab_release(struct Slab *slab) {
+    partial_remove(slab);
+    sys_unmap_region(CURENVID, (uint8_t *)slab + PAGE_SIZE, MALLOC_SLAB_SIZE - PAGE_SIZE);
+    slab->next = free_slabs;
+    free_slabs = slab;
+    stats.slabs--;
+    stats.slabs_released++;
+}
+
+/* Takes object of 'class' from slabs */
+static void *
+slab_alloc(int class) {
+    struct Slab *slab = partial[class];
+    if (!slab && !(slab = slab_create(class))) return NULL;
+
+    void *obj = slab->free;
+    if (obj)
+        slab->free = obj_next(obj);
+    else
+        obj = (uint8_t *)slab + SLAB_HEADER + slab->carved++ * class_size(class);
+    slab->used++;
+
+    if (slab_full(slab)) partial_remove(slab);
+    return obj;
+}
+
+/* Returns object to its slab.
+ * Empty slab is released unless it is the only partial one. */
+static void
+slab_free(void *obj) {
+    struct Slab *slab = ROUNDDOWN(obj, MALLOC_SLAB_SIZE);
+    if (slab_full(slab)) partial_push(slab);
+
+    obj_set_next(obj, slab->free);
+    slab->free = obj;
+    slab->used--;
+
+    if (!slab->used && (slab->prev || slab->next)) slab_release(slab);
+}
+
+/* First fit in remembered free ranges, then fresh address space */
+static uintptr_t
+large_reserve(size_t size) {
+    for (size_t i = 0; i < MALLOC_LARGE_FREE; i++) {
+        if (large_free[i].size >= size) {
+            uintptr_t va = large_free[i].va;
+            large_free[i].va += size;
+            large_free[i].size -= size;
+            return va;
+        }
+    }
+
+    if (MALLOC_BASE + MALLOC_SIZE - large_top < size) return 0;
+    uintptr_t va = large_top;
+    large_top += size;
+    return va;
+}
+
+static void
+large_unreserve(uintptr_t va, size_t size) {
+    for (size_t i = 0; i < MALLOC_LARGE_FREE; i++) {
+        if (!large_free[i].size) {
+            large_free[i].va = va;
+            large_free[i].size = size;
+            return;
+        }
+    }
+    /* Address space is leaked, it is not backed by memory anyway */
+}
+
+static void *
+large_alloc(size_t size) {
+    if (size > MALLOC_SIZE / 2) return NULL;
+    size_t total = ROUNDUP(size + LARGE_HEADER, PAGE_SIZE);
+
+    uintptr_t va = large_reserve(total);
+    if (!va) return NULL;
+
+    if (sys_alloc_region(CURENVID, (void *)va, total, PROT_RW) < 0) {
+        large_unreserve(va, total);
+        return NULL;
+    }
+
+    struct LargeHeader *hdr = (struct LargeHeader *)va;
+    hdr->size = total;
+    hdr->magic = LARGE_MAGIC;
+    asan_free(hdr, LARGE_HEADER);
+    asan_malloc((uint8_t *)va + LARGE_HEADER, size, total - LARGE_HEADER);
+
+    stats.large++;
+    stats.large_bytes += total;
+    return (uint8_t *)va + LARGE_HEADER;
+}
+
+static NOSAN struct LargeHeader *
+large_header(void *ptr) {
+    struct LargeHeader *hdr = (struct LargeHeader *)((uint8_t *)ptr - LARGE_HEADER);
+    if (hdr->magic != LARGE_MAGIC) panic("free: bad pointer %p", ptr);
+    return hdr;
+}
+
+static void
+large_release(void *ptr) {
+    struct LargeHeader *hdr = large_header(ptr);
+    size_t total = hdr->size;
+    sys_unmap_region(CURENVID, hdr, total);
+
+    large_unreserve((uintptr_t)hdr, total);
+    stats.large--;
+    stats.large_bytes -= total;
+}
+
+static bool
+is_large(void *ptr) {
+    return (uintptr_t)ptr >= LARGE_AREA && (uintptr_t)ptr < MALLOC_BASE + MALLOC_SIZE;
+}
+
+static size_t
+usable_size(void *ptr) {
+    if (is_large(ptr)) return large_header(ptr)->size - LARGE_HEADER;
+
+    struct Slab *slab = ROUNDDOWN(ptr, MALLOC_SLAB_SIZE);
+    return class_size(slab->class);
+}
+
+/* Returns at least 'size' bytes aligned to 16 bytes,
+ * NULL if there is no memory */
+void *
+malloc(size_t size) {
+    if (!size) size = 1;
+    if (size > MALLOC_SMALL_MAX) return large_alloc(size);
+
+    int class = size_class(size);
+    void *obj = slab_alloc(class);
+    if (!obj) return NULL;
+
+    asan_malloc(obj, size, class_size(class));
+    return obj;
+}
+
+void *
+calloc(size_t nmemb, size_t size) {
+    if (size && nmemb > (size_t)-1 / size) return NULL;
+
+    void *ptr = malloc(nmemb * size);
+    if (ptr) memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void
+free(void *ptr) {
+    if (!ptr) return;
+    if (is_large(ptr)) {
+        large_release(ptr);
+        return;
+    }
+
+    if ((uintptr_t)ptr < SLAB_AREA || (uintptr_t)ptr >= slab_top)
+        panic("free: bad pointer %p", ptr);
+
+    asan_free(ptr, usable_size(ptr));
+    slab_free(ptr);
+}
+
+/* Object is kept in place if it is large enough */
+void *
+realloc(void *ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+
+    size_t old = usable_size(ptr);
+    if (size <= old) {
+        asan_malloc(ptr, size, old);
+        return ptr;
+    }
+
+    void *res = malloc(size);
+    if (!res) return NULL;
+    chunk_copy(res, ptr, old);
+    free(ptr);
+    return res;
+}
+
+void
+malloc_stats(struct MallocStats *res) {
+    *res = stats;
+}
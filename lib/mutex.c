@@ -0,0 +1,75 @@
+/* Sleeping mutex and condition variable on top of
+ * sys_futex_wait()/sys_futex_wake() (see U. Drepper, "Futexes Are Tricky").
+ * System calls are made only if the mutex is contended. */
+
+#include <inc/lib.h>
+
+static uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t expected, uint32_t newval) {
+    __atomic_compare_exchange_n(addr, &expected, newval, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+static void
+futex_wait(volatile uint32_t *addr, uint32_t expected) {
+    int res = sys_futex_wait(addr, expected, 0);
+    if (res < 0 && res != -E_AGAIN) panic("sys_futex_wait: %i", res);
+}
+
+static void
+futex_wake(volatile uint32_t *addr, int count) {
+    int res = sys_futex_wake(addr, count);
+    if (res < 0) panic("sys_futex_wake: %i", res);
+}
+
+void
+mutex_lock(struct Mutex *mtx) {
+    uint32_t state = cmpxchg(&mtx->state, 0, 1);
+    if (!state) return;
+
+    /* Mark mutex contended so that the owner wakes us up */
+    if (state != 2) state = __atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE);
+    while (state) {
+        futex_wait(&mtx->state, 2);
+        state = __atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+bool
+mutex_trylock(struct Mutex *mtx) {
+    return !cmpxchg(&mtx->state, 0, 1);
+}
+
+void
+mutex_unlock(struct Mutex *mtx) {
+    if (__atomic_fetch_sub(&mtx->state, 1, __ATOMIC_RELEASE) != 1) {
+        mtx->state = 0;
+        futex_wake(&mtx->state, 1);
+    }
+}
+
+/* Waiter is woken up by any signal issued after it
+ * released the mutex, wakeups might be spurious */
+void
+cond_wait(struct CondVar *cv, struct Mutex *mtx) {
+    uint32_t seq = cv->seq;
+    mutex_unlock(mtx);
+    futex_wait(&cv->seq, seq);
+
+    /* Other waiters might be woken by broadcast too,
+     * so the mutex is always taken as contended */
+    while (__atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE))
+        futex_wait(&mtx->state, 2);
+}
+
+void
+cond_signal(struct CondVar *cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&cv->seq, 1);
+}
+
+void
+cond_broadcast(struct CondVar *cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&cv->seq, NENV);
+}
@@ -31,6 +31,10 @@ static const char *const error_string[MAXERROR] = {
         [E_NO_SYS] = "no such system call",
         [E_IPC_NOT_RECV] = "env is not recving",
         [E_EOF] = "unexpected end of file",
+        [E_MAILBOX_FULL] = "env mailbox is full",
+        [E_AGAIN] = "value changed, try again",
+        [E_TIMEOUT] = "wait timed out",
+        [E_NO_CPU] = "not enough CPU time",
 };
 
 /*
@@ -2,11 +2,53 @@
 
 #include <inc/syscall.h>
 #include <inc/lib.h>
+#include <inc/x86.h>
+
+#ifndef CONFIG_KSPACE
+/* SYSCALL instruction support (enabled by kernel in trap_init_percpu()):
+ * 0 - not checked yet, 1 - supported, -1 - not supported */
+static int fast_syscall_state;
+
+static bool
+fast_syscall_supported(void) {
+    if (!fast_syscall_state) {
+        uint32_t features;
+        cpuid(0x80000001, NULL, NULL, NULL, &features);
+        fast_syscall_state = features & CPUID_EXT_SYSCALL ? 1 : -1;
+    }
+    return fast_syscall_state > 0;
+}
+#endif
 
 static inline int64_t __attribute__((always_inline))
 syscall(uintptr_t num, bool check, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
     intptr_t ret;
 
+#ifndef CONFIG_KSPACE
+    if (fast_syscall_supported()) {
+        /* Fast system call.
+         * Same registers as for int $T_SYSCALL except that
+         * second parameter is passed in R10 since SYSCALL
+         * uses RCX and R11 for user RIP and RFLAGS.
+         * Kernel does not preserve scratch registers. */
+        register uintptr_t _a0 asm("rax") = num,
+                           _a1 asm("rdx") = a1, _a2 asm("r10") = a2,
+                           _a3 asm("rbx") = a3, _a4 asm("rdi") = a4,
+                           _a5 asm("rsi") = a5, _a6 asm("r8")  = a6;
+
+        asm volatile("syscall\n"
+                     : "+r"(_a0), "+r"(_a1), "+r"(_a2), "+r"(_a4), "+r"(_a5), "+r"(_a6)
+                     : "r"(_a3)
+                     : "rcx", "r9", "r11", "cc", "memory");
+
+        ret = _a0;
+        if (check && ret > 0) {
+            panic("syscall %zd returned %zd (> 0)", num, ret);
+        }
+        return ret;
+    }
+#endif
+
     /* Generic system call.
      * Pass system call number in RAX,
      * Up to six parameters in RDX, RCX, RBX, RDI, RSI and R8.
@@ -100,6 +142,11 @@ sys_map_region(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, size_t
     return res;
 }
 
+int
+sys_map_regions(envid_t srcenv, envid_t dstenv, const struct MapRegion *vec, size_t count) {
+    return syscall(SYS_map_regions, 1, srcenv, dstenv, (uintptr_t)vec, count, 0, 0);
+}
+
 int
 sys_unmap_region(envid_t envid, void *va, size_t size) {
     int res = syscall(SYS_unmap_region, 1, envid, (uintptr_t)va, size, 0, 0, 0);
@@ -129,6 +176,55 @@ sys_ipc_try_send(envid_t envid, uintptr_t value, void *srcva, size_t size, int p
     return syscall(SYS_ipc_try_send, 0, envid, value, (uintptr_t)srcva, size, perm, 0);
 }
 
+int
+sys_env_set_mempolicy(envid_t envid, int policy, uint32_t nodemask) {
+    return syscall(SYS_env_set_mempolicy, 1, envid, policy, nodemask, 0, 0, 0);
+}
+
+int
+sys_env_snapshot(envid_t envid) {
+    return syscall(SYS_env_snapshot, 0, envid, 0, 0, 0, 0, 0);
+}
+
+int
+sys_env_restore(envid_t envid) {
+    return syscall(SYS_env_restore, 1, envid, 0, 0, 0, 0, 0);
+}
+
+int
+sys_region_extents(envid_t envid, void *start, void *end, struct MapExtent *buf, size_t count) {
+    return syscall(SYS_region_extents, 0, envid, (uintptr_t)start, (uintptr_t)end, (uintptr_t)buf, count, 0);
+}
+
+int
+sys_ring_setup(struct SysRing *ring) {
+    return syscall(SYS_ring_setup, 1, (uintptr_t)ring, 0, 0, 0, 0, 0);
+}
+
+int
+sys_ring_enter(void) {
+    return syscall(SYS_ring_enter, 0, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_ipc_send(envid_t envid, uintptr_t value, void *srcva, size_t size, int perm) {
+    return syscall(SYS_ipc_send, 0, envid, value, (uintptr_t)srcva, size, perm, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uintptr_t value, void *srcva, size_t size, int perm) {
+    return syscall(SYS_ipc_call, 0, envid, value, (uintptr_t)srcva, size, perm, 0);
+}
+
+int
+sys_ipc_reply_recv(envid_t envid, uintptr_t value, void *dstva, size_t size) {
+    int res = syscall(SYS_ipc_reply_recv, 1, envid, value, (uintptr_t)dstva, size, 0, 0);
+#ifdef SANITIZE_USER_SHADOW_BASE
+    if (!res) platform_asan_unpoison(dstva, thisenv->env_ipc_maxsz);
+#endif
+    return res;
+}
+
 int
 sys_ipc_recv(void *dstva, size_t size) {
     int res = syscall(SYS_ipc_recv, 1, (uintptr_t)dstva, size, 0, 0, 0, 0);
@@ -137,3 +233,84 @@ sys_ipc_recv(void *dstva, size_t size) {
 #endif
     return res;
 }
+
+int
+sys_ipc_send_regs(envid_t envid, const uint64_t words[IPC_MAX_WORDS]) {
+    /* Receiver goes to the upper half of system call number */
+    return syscall(SYS_ipc_send_regs | (uint64_t)(uint32_t)envid << 32, 0,
+                   words[0], words[1], words[2], words[3], words[4], words[5]);
+}
+
+int
+sys_ipc_mailbox(size_t depth, void *grant_va, size_t grant_size) {
+    return syscall(SYS_ipc_mailbox, 1, depth, (uintptr_t)grant_va, grant_size, 0, 0, 0);
+}
+
+int
+sys_ipc_recv_batch(struct IpcMessage *buf, size_t count) {
+    int res = syscall(SYS_ipc_recv_batch, 0, (uintptr_t)buf, count, 0, 0, 0, 0);
+#ifdef SANITIZE_USER_SHADOW_BASE
+    for (int i = 0; i < res; i++)
+        if (buf[i].va < MAX_USER_ADDRESS) platform_asan_unpoison((void *)buf[i].va, buf[i].size);
+#endif
+    return res;
+}
+
+int
+sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint64_t timeout) {
+    return syscall(SYS_futex_wait, 0, (uintptr_t)addr, expected, timeout, 0, 0, 0);
+}
+
+int
+sys_futex_wake(volatile uint32_t *addr, int count) {
+    return syscall(SYS_futex_wake, 0, (uintptr_t)addr, count, 0, 0, 0, 0);
+}
+
+int
+sys_wait(const struct WaitEvent *events, size_t count) {
+    return syscall(SYS_wait, 0, (uintptr_t)events, count, 0, 0, 0, 0);
+}
+
+int
+sys_env_set_weight(envid_t envid, uint32_t weight) {
+    return syscall(SYS_env_set_weight, 1, envid, weight, 0, 0, 0, 0);
+}
+
+int
+sys_env_set_rt(envid_t envid, uint64_t runtime, uint64_t period, uint64_t deadline) {
+    return syscall(SYS_env_set_rt, 1, envid, runtime, period, deadline, 0, 0);
+}
+
+int
+sys_ipc_recv_regs(uint64_t words[IPC_MAX_WORDS]) {
+    /* Message words are returned in argument registers
+     * so generic syscall() cannot be used here */
+#ifndef CONFIG_KSPACE
+    bool fast = fast_syscall_supported();
+#endif
+
+    register uintptr_t _a0 asm("rax") = SYS_ipc_recv_regs;
+    register uintptr_t _a1 asm("rdx"), _a2 asm("rcx"), _a3 asm("rbx"),
+                       _a4 asm("rdi"), _a5 asm("rsi"), _a6 asm("r8");
+
+#ifndef CONFIG_KSPACE
+    if (fast) {
+        asm volatile("syscall\n"
+                     : "+r"(_a0), "=r"(_a1), "=r"(_a2), "=r"(_a3), "=r"(_a4), "=r"(_a5), "=r"(_a6)
+                     :
+                     : "r9", "r10", "r11", "cc", "memory");
+    } else
+#endif
+    {
+        asm volatile("int %7\n"
+                     : "+r"(_a0), "=r"(_a1), "=r"(_a2), "=r"(_a3), "=r"(_a4), "=r"(_a5), "=r"(_a6)
+                     : "i"(T_SYSCALL)
+                     : "cc", "memory");
+    }
+
+    if ((intptr_t)_a0 < 0) return _a0;
+
+    words[0] = _a1, words[1] = _a2, words[2] = _a3;
+    words[3] = _a4, words[4] = _a5, words[5] = _a6;
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* Batched system calls through a ring shared with the kernel */
+
+#include <inc/lib.h>
+
+/* Registers zeroed ring, it should be page aligned */
+int
+sysring_init(struct SysRing *ring) {
+    memset(ring, 0, sizeof(*ring));
+    return sys_ring_setup(ring);
+}
+
+/* Queues system call 'num', entering the kernel to execute
+ * queued entries if submission queue is full.
+ * Returns -E_NO_MEM if completions should be reaped first. */
+int
+sysring_submit(struct SysRing *ring, uint64_t user_data, int num,
+               uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
+    while (ring->sq_tail - ring->sq_head == SYSRING_ENTRIES) {
+        int res = sys_ring_enter();
+        if (res < 0) return res;
+        if (!res) return -E_NO_MEM;
+    }
+
+    struct SysRingEntry *sqe = &ring->sq[ring->sq_tail % SYSRING_ENTRIES];
+    sqe->num = num;
+    sqe->args[0] = a1;
+    sqe->args[1] = a2;
+    sqe->args[2] = a3;
+    sqe->args[3] = a4;
+    sqe->args[4] = a5;
+    sqe->args[5] = a6;
+    sqe->user_data = user_data;
+
+    /* Entry should be visible before the tail moves */
+    asm volatile("" ::: "memory");
+    ring->sq_tail++;
+    return 0;
+}
+
+/* Fetches the oldest completion, returns false if there is none */
+bool
+sysring_complete(struct SysRing *ring, struct SysCompletion *cqe) {
+    if (ring->cq_head == ring->cq_tail) return 0;
+
+    *cqe = ring->cq[ring->cq_head % SYSRING_ENTRIES];
+    asm volatile("" ::: "memory");
+    ring->cq_head++;
+    return 1;
+}
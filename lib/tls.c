@@ -0,0 +1,29 @@
+/* Thread-local storage for environments sharing address space */
+
+#include <inc/lib.h>
+
+/* Keys are global and shared by all environments created
+ * with sfork(), values are stored in private USER_TLS page */
+static uint32_t tls_next_key;
+
+/* Allocates key with NULL value in every environment.
+ * Returns the key, < 0 on error.  Errors are:
+ *  -E_NO_MEM if all TLS_KEYS keys are allocated. */
+int
+tls_key_create(void) {
+    uint32_t key = __atomic_fetch_add(&tls_next_key, 1, __ATOMIC_RELAXED);
+    if (key >= TLS_KEYS) return -E_NO_MEM;
+    return key;
+}
+
+void *
+tls_get(int key) {
+    assert(key >= 0 && key < TLS_KEYS);
+    return utls->values[key];
+}
+
+void
+tls_set(int key, void *value) {
+    assert(key >= 0 && key < TLS_KEYS);
+    utls->values[key] = value;
+}
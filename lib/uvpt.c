@@ -38,9 +38,42 @@ is_page_present(void *va) {
     return get_uvpt_entry(va) & PTE_P;
 }
 
+#define NEXTENTS 32
+
 int
 foreach_shared_region(int (*fun)(void *start, void *end, void *arg), void *arg) {
-    /* Calls fun() for every shared region */
-    // LAB 11: Your code here
+    /* Calls fun() for every shared region
+     * (mapping extents are queried from kernel in batches
+     *  instead of walking page tables page by page) */
+    struct MapExtent ext[NEXTENTS];
+    uintptr_t addr = 0, shared_start = 0, shared_end = 0;
+    int res;
+
+    for (;;) {
+        int n = sys_region_extents(CURENVID, (void *)addr, (void *)MAX_USER_ADDRESS, ext, NEXTENTS);
+        if (n < 0) return n;
+
+        for (int i = 0; i < n; i++) {
+            if (!(ext[i].prot & PROT_SHARE)) continue;
+
+            /* Join adjacent shared extents */
+            if (shared_end == ext[i].start) {
+                shared_end += ext[i].size;
+                continue;
+            }
+            if (shared_start != shared_end &&
+                (res = fun((void *)shared_start, (void *)shared_end, arg)) < 0) return res;
+            shared_start = ext[i].start;
+            shared_end = ext[i].start + ext[i].size;
+        }
+
+        if (n < NEXTENTS) break;
+        addr = ext[n - 1].start + ext[n - 1].size;
+        if (addr >= MAX_USER_ADDRESS) break;
+    }
+
+    if (shared_start != shared_end &&
+        (res = fun((void *)shared_start, (void *)shared_end, arg)) < 0) return res;
+
     return 0;
 }
@@ -0,0 +1,26 @@
+/* Readers of the kernel maintained UVSYS page */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+envid_t
+vsys_getenvid(void) {
+    return vsys.envid;
+}
+
+uint32_t
+vsys_env_runs(void) {
+    return vsys.env_runs;
+}
+
+/* Nanoseconds since boot */
+uint64_t
+vsys_gettime(void) {
+    uint64_t delta = read_tsc() - vsys.tsc_base;
+    return (uint64_t)(((unsigned __int128)delta * vsys.tsc_mult) >> vsys.tsc_shift);
+}
+
+uint64_t
+vsys_ticks(void) {
+    return vsys.ticks;
+}
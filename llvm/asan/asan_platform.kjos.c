@@ -61,6 +61,23 @@ platform_asan_poison(void *addr, size_t size) {
     asan_internal_fill_range((uptr)addr, size, ASAN_GLOBAL_RZ);
 }
 
+/* Heap allocator hooks (see kern/kmalloc.c), chunks are shadow-aligned */
+void
+platform_asan_malloc(void *addr, size_t size, size_t chunk) {
+    size_t valid = ROUNDDOWN(size, SHADOW_ALIGN);
+    asan_internal_fill_range((uptr)addr, valid, 0);
+    if (valid < chunk)
+        asan_internal_fill_range((uptr)addr + valid, chunk - valid, ASAN_HEAP_RIGHT_RZ);
+    /* Partially valid granule keeps number of valid bytes */
+    if (size & SHADOW_MASK)
+        *SHADOW_FOR_ADDRESS((uptr)addr + valid) = size & SHADOW_MASK;
+}
+
+void
+platform_asan_free(void *addr, size_t chunk) {
+    asan_internal_fill_range((uptr)addr, chunk, ASAN_HEAP_FREED);
+}
+
 void
 platform_asan_fatal(const char *msg, uptr p, size_t width, unsigned access_type) {
     ASAN_LOG("Fatal error: %s (addr 0x%lx within i/o size 0x%lx of type %u), tracing:",
@@ -127,14 +127,12 @@ platform_asan_init() {
     asan_internal_fill_range((uptr) (USER_EXCEPTION_STACK_TOP - USER_EXCEPTION_STACK_SIZE), USER_EXCEPTION_STACK_SIZE, 0);
     asan_internal_fill_range((uptr) (USER_STACK_TOP - USER_STACK_SIZE), USER_STACK_SIZE, 0);
 
-    /* 3. Kernel exposed info (UENVS, UVSYS (only for lab 12)) */
+    /* 3. Kernel exposed info (UENVS, UVSYS) */
     // LAB 8: Your code here
 
     asan_internal_fill_range((uptr) UENVS, UENVS_SIZE, 0);
 
-#if LAB >= 12
-    platform_asan_unpoison((uptr)UVSYS, NVSYSCALLS * sizeof(int));
-#endif
+    asan_internal_fill_range((uptr) UVSYS, UVSYS_SIZE, 0);
 
     /* 4. Shared pages
      * HINT: Use foreach_shared_region() with asan_unpoison_shared_region() */
@@ -155,6 +153,23 @@ platform_asan_poison(void *addr, size_t size) {
     asan_internal_fill_range((uptr)addr, size, ASAN_GLOBAL_RZ);
 }
 
+/* Heap allocator hooks (see lib/malloc.c), chunks are shadow-aligned */
+void
+platform_asan_malloc(void *addr, size_t size, size_t chunk) {
+    size_t valid = ROUNDDOWN(size, SHADOW_ALIGN);
+    asan_internal_fill_range((uptr)addr, valid, 0);
+    if (valid < chunk)
+        asan_internal_fill_range((uptr)addr + valid, chunk - valid, ASAN_HEAP_RIGHT_RZ);
+    /* Partially valid granule keeps number of valid bytes */
+    if (size & SHADOW_MASK)
+        *SHADOW_FOR_ADDRESS((uptr)addr + valid) = size & SHADOW_MASK;
+}
+
+void
+platform_asan_free(void *addr, size_t chunk) {
+    asan_internal_fill_range((uptr)addr, chunk, ASAN_HEAP_FREED);
+}
+
 void
 platform_asan_fatal(const char *msg, uptr p, size_t width, unsigned access_type) {
     ASAN_LOG("Fatal error: %s (addr 0x%lx within i/o size 0x%lx of type %u), tracing:",
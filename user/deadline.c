@@ -0,0 +1,117 @@
+/* Real-time environments compete with a CPU-bound fair share one.
+ * Periodic ones that stay within their budgets should never miss
+ * deadlines, the one that spins all the time should be throttled
+ * to its reservation. Compare with 'sched' monitor command */
+
+#include <inc/lib.h>
+
+#define NCHILD 3
+#define TEST_NS 500000000ULL
+
+struct Task {
+    const char *name;
+    uint64_t runtime, period, deadline; /* Reservation, us */
+    uint64_t work;                      /* Work per job, us, 0 - spin all the time */
+};
+
+static const struct Task tasks[NCHILD] = {
+        {"periodic", 3000, 10000, 0, 1000},
+        {"constrained", 2000, 20000, 5000, 500},
+        {"overrun", 1000, 10000, 0, 0},
+};
+
+static void
+spin(uint64_t ns) {
+    for (uint64_t end = vsys_gettime() + ns; vsys_gettime() < end;)
+        ;
+}
+
+static void
+child(const struct Task *task) {
+    envid_t parent;
+
+    /* Wait until reservations are made */
+    ipc_recv(&parent, NULL, NULL, NULL);
+
+    if (task->work) {
+        for (uint64_t i = 0; i < TEST_NS / 1000 / task->period; i++) {
+            spin(task->work * 1000);
+            /* Job is done, wait for the next period */
+            sys_yield();
+        }
+    } else {
+        spin(TEST_NS);
+    }
+
+    /* Let parent read statistics before exit */
+    ipc_send(parent, 0, NULL, 0, 0);
+    ipc_recv(NULL, NULL, NULL, NULL);
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t ids[NCHILD];
+
+    /* Fair share env that never yields */
+    envid_t hog = fork();
+    if (hog < 0) panic("fork: %i", hog);
+    if (!hog)
+        for (;;)
+            ;
+
+    for (int i = 0; i < NCHILD; i++) {
+        envid_t id = fork();
+        if (id < 0) panic("fork: %i", id);
+        if (!id) {
+            child(&tasks[i]);
+            return;
+        }
+
+        int res = sys_env_set_rt(id, tasks[i].runtime, tasks[i].period, tasks[i].deadline);
+        if (res < 0) panic("sys_env_set_rt: %i", res);
+        ids[i] = id;
+    }
+
+    /* Invalid parameters */
+    assert(sys_env_set_rt(hog, SCHED_RT_RUNTIME_MIN_US - 1, 10000, 0) == -E_INVAL);
+    assert(sys_env_set_rt(hog, 2000, 10000, 1000) == -E_INVAL);
+    assert(sys_env_set_rt(hog, 2000, 10000, 20000) == -E_INVAL);
+    assert(sys_env_set_rt(hog, 2000, SCHED_RT_PERIOD_MAX_US + 1, 10000) == -E_INVAL);
+
+    /* 30% + 40% + 10% are reserved, 20% more doesn't fit */
+    assert(sys_env_set_rt(hog, 2000, 10000, 0) == -E_NO_CPU);
+    assert(sys_env_set_rt(hog, 1000, 10000, 0) == 0);
+    assert(sys_env_set_rt(hog, 0, 0, 0) == 0);
+
+    uint64_t start = vsys_gettime();
+    for (int i = 0; i < NCHILD; i++)
+        ipc_send(ids[i], 0, NULL, 0, 0);
+
+    for (int i = 0; i < NCHILD; i++)
+        ipc_recv(NULL, NULL, NULL, NULL);
+    uint64_t elapsed = vsys_gettime() - start;
+
+    for (int i = 0; i < NCHILD; i++) {
+        const volatile struct Env *env = &envs[ENVX(ids[i])];
+        uint64_t runtime = ((unsigned __int128)env->env_runtime * vsys.tsc_mult) >> vsys.tsc_shift;
+        cprintf("%-11s: %3u jobs, %3u misses, %3u overruns, max late %5uus, cpu %2u%%\n", tasks[i].name,
+                (unsigned)env->env_rt_stats.jobs, (unsigned)env->env_rt_stats.misses,
+                (unsigned)env->env_rt_stats.overruns, (unsigned)env->env_rt_stats.max_late_us,
+                (unsigned)(runtime * 100 / elapsed));
+
+        if (tasks[i].work) {
+            assert(env->env_rt_stats.jobs == TEST_NS / 1000 / tasks[i].period);
+            assert(!env->env_rt_stats.misses);
+        } else {
+            assert(env->env_rt_stats.overruns && env->env_rt_stats.misses >= env->env_rt_stats.overruns);
+            /* Budget is 10% of CPU, leave room for timer latency */
+            assert(runtime * 100 / elapsed < 20);
+        }
+    }
+
+    for (int i = 0; i < NCHILD; i++)
+        ipc_send(ids[i], 0, NULL, 0, 0);
+    sys_env_destroy(hog);
+
+    cprintf("deadline done\n");
+}
@@ -0,0 +1,48 @@
+/* Measure teardown of large address spaces.
+ * Every iteration forks a child that touches a region
+ * of given size and exits. The parent spins until the child
+ * is freed and records the longest gap between two reads of TSC,
+ * i.e. the longest time it was kept off the CPU.
+ * Run 'ptstat' in monitor afterwards to see the longest
+ * non-preemptible teardown step measured by the kernel. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define MAX_SIZE (64 * 1024 * 1024)
+
+static uint8_t *const region = (uint8_t *)0x10000000;
+
+static void
+child(size_t size) {
+    int res = sys_alloc_region(CURENVID, region, size, PROT_RW);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+
+    for (size_t i = 0; i < size; i += PAGE_SIZE)
+        region[i] = (uint8_t)i;
+
+    exit();
+}
+
+void
+umain(int argc, char **argv) {
+    for (size_t size = 1024 * 1024; size <= MAX_SIZE; size *= 4) {
+        envid_t envid = fork();
+        if (envid < 0) panic("fork: %i", envid);
+        if (!envid) child(size);
+
+        const volatile struct Env *env = &envs[ENVX(envid)];
+        while (env->env_id == envid && env->env_status != ENV_DYING && env->env_status != ENV_FREE)
+            sys_yield();
+
+        uint64_t start = read_tsc(), last = start, max_gap = 0;
+        while (env->env_id == envid && env->env_status != ENV_FREE) {
+            uint64_t now = read_tsc();
+            if (now - last > max_gap) max_gap = now - last;
+            last = now;
+        }
+
+        cprintf("exitbench: %zuM released in %lu cycles, longest gap %lu cycles\n", size / (1024 * 1024),
+                (unsigned long)(read_tsc() - start), (unsigned long)max_gap);
+    }
+}
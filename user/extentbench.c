@@ -0,0 +1,76 @@
+/* Compare enumeration of shared regions through
+ * sys_region_extents() (used by foreach_shared_region()
+ * during ASAN initialization) with page table walking
+ * through UVPT on a sparse multi-gigabyte layout. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSHARED   16
+#define STRIDE    (256 * 1024 * 1024ULL)
+#define LAZY_SIZE (1024 * 1024 * 1024ULL)
+#define LIMIT     (8 * 1024 * 1024 * 1024ULL)
+
+extern volatile pte_t uvpt[];
+extern volatile pde_t uvpd[];
+extern volatile pdpe_t uvpdp[];
+extern volatile pml4e_t uvpml4[];
+
+static uint8_t *const base = (uint8_t *)0x100000000;
+
+static int
+count_region(void *start, void *end, void *arg) {
+    (*(size_t *)arg)++;
+    return 0;
+}
+
+/* Walk page tables skipping non-present levels */
+static size_t
+walk_uvpt(uintptr_t limit) {
+    size_t count = 0;
+    bool in_shared = 0;
+    uintptr_t va = 0;
+    while (va < limit) {
+        size_t step = PAGE_SIZE;
+        pte_t pte;
+        if (!((pte = uvpml4[VPML4(va)]) & PTE_P)) {
+            step = 512 * 1024 * 1024 * 1024ULL;
+        } else if (!((pte = uvpdp[VPDP(va)]) & PTE_P) || pte & PTE_PS) {
+            step = 1024 * 1024 * 1024ULL;
+        } else if (!((pte = uvpd[VPD(va)]) & PTE_P) || pte & PTE_PS) {
+            step = 2 * 1024 * 1024ULL;
+        } else {
+            pte = uvpt[VPT(va)];
+        }
+
+        bool shared = (pte & PTE_P) && (pte & PTE_SHARE);
+        if (shared && !in_shared) count++;
+        in_shared = shared;
+        va = ROUNDDOWN(va, step) + step;
+    }
+    return count;
+}
+
+void
+umain(int argc, char **argv) {
+    int res = sys_alloc_region(CURENVID, base, LAZY_SIZE, PROT_RW);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+
+    for (size_t i = 0; i < NSHARED; i++) {
+        res = sys_alloc_region(CURENVID, base + LAZY_SIZE + i * STRIDE, PAGE_SIZE, PROT_RW | PROT_SHARE);
+        if (res < 0) panic("sys_alloc_region: %i", res);
+    }
+
+    size_t nregions = 0;
+    uint64_t start = read_tsc();
+    res = foreach_shared_region(count_region, &nregions);
+    uint64_t extent_cycles = read_tsc() - start;
+    if (res < 0) panic("foreach_shared_region: %i", res);
+
+    start = read_tsc();
+    size_t nwalked = walk_uvpt(LIMIT);
+    uint64_t walk_cycles = read_tsc() - start;
+
+    cprintf("extentbench: extents %zu regions in %lu cycles, uvpt walk %zu regions in %lu cycles\n",
+            nregions, (unsigned long)extent_cycles, nwalked, (unsigned long)walk_cycles);
+}
@@ -0,0 +1,69 @@
+/* CPU-bound environments with different weights spin for the same
+ * wall clock time, the number of iterations each of them makes
+ * should be roughly proportional to its weight.
+ * Compare with 'sched' monitor command */
+
+#include <inc/lib.h>
+
+#define NCHILD  3
+#define SPIN_NS 500000000ULL
+
+static const uint32_t weights[NCHILD] = {SCHED_WEIGHT_DEFAULT / 2, SCHED_WEIGHT_DEFAULT, SCHED_WEIGHT_DEFAULT * 2};
+
+static void
+child(void) {
+    envid_t parent;
+
+    /* Wait until all children are created */
+    ipc_recv(&parent, NULL, NULL, NULL);
+
+    uint32_t count = 0;
+    for (uint64_t deadline = vsys_gettime() + SPIN_NS; vsys_gettime() < deadline;)
+        count++;
+
+    ipc_send(parent, count, NULL, 0, 0);
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t ids[NCHILD];
+    uint32_t counts[NCHILD];
+
+    for (int i = 0; i < NCHILD; i++) {
+        envid_t id = fork();
+        if (id < 0) panic("fork: %i", id);
+        if (!id) {
+            child();
+            return;
+        }
+
+        int res = sys_env_set_weight(id, weights[i]);
+        if (res < 0) panic("sys_env_set_weight: %i", res);
+        ids[i] = id;
+    }
+
+    assert(sys_env_set_weight(ids[0], 0) == -E_INVAL);
+    assert(sys_env_set_weight(ids[0], SCHED_WEIGHT_MAX + 1) == -E_INVAL);
+
+    for (int i = 0; i < NCHILD; i++)
+        ipc_send(ids[i], 0, NULL, 0, 0);
+
+    for (int i = 0; i < NCHILD; i++) {
+        envid_t from;
+        uint32_t count = ipc_recv(&from, NULL, NULL, NULL);
+        for (int j = 0; j < NCHILD; j++)
+            if (ids[j] == from) counts[j] = count;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < NCHILD; i++) total += counts[i];
+    for (int i = 0; i < NCHILD; i++)
+        cprintf("weight %5u: %10u iterations, %2u%% (expected %u%%)\n", weights[i], counts[i],
+                (unsigned)(counts[i] * 100 / total), (unsigned)(weights[i] * 100 / (weights[0] + weights[1] + weights[2])));
+
+    /* Shares are 1:2:4, leave room for timer granularity */
+    assert(counts[0] < counts[1] && counts[1] < counts[2]);
+    assert(counts[2] > counts[0] * 2);
+
+    cprintf("fairshare done\n");
+}
@@ -0,0 +1,34 @@
+/* Measure latency of environment creation and teardown.
+ * Every iteration forks a child that exits immediately,
+ * the parent waits for the child to be freed. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER 64
+
+static void
+wait_env(envid_t envid) {
+    const volatile struct Env *env = &envs[ENVX(envid)];
+    while (env->env_id == envid && env->env_status != ENV_FREE)
+        sys_yield();
+}
+
+void
+umain(int argc, char **argv) {
+    uint64_t fork_cycles = 0, total_cycles = 0;
+
+    for (int i = 0; i < NITER; i++) {
+        uint64_t start = read_tsc();
+        envid_t envid = fork();
+        if (envid < 0) panic("fork: %i", envid);
+        if (!envid) exit();
+
+        fork_cycles += read_tsc() - start;
+        wait_env(envid);
+        total_cycles += read_tsc() - start;
+    }
+
+    cprintf("forkbench: %d iterations, fork %lu cycles, fork+exit %lu cycles\n", NITER,
+            (unsigned long)(fork_cycles / NITER), (unsigned long)(total_cycles / NITER));
+}
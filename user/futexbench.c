@@ -0,0 +1,99 @@
+/* Contention benchmark: NWORKERS environments increment a shared
+ * counter under a futex based mutex and under a spinlock that
+ * yields the CPU, then pass a token around with a condition variable. */
+
+#include <inc/lib.h>
+
+#define NWORKERS 4
+#define NITER    5000
+#define NROUNDS  1000
+
+struct Shared {
+    struct Mutex mtx;
+    volatile uint32_t spin;
+    volatile uint64_t counter;
+    struct CondVar cv;
+    volatile uint32_t turn;
+    volatile uint32_t done;
+};
+
+static struct Shared *const shared = (struct Shared *)0x10000000;
+
+static void
+spin_lock(void) {
+    while (__atomic_exchange_n(&shared->spin, 1, __ATOMIC_ACQUIRE)) sys_yield();
+}
+
+static void
+spin_unlock(void) {
+    __atomic_store_n(&shared->spin, 0, __ATOMIC_RELEASE);
+}
+
+static void
+worker(bool futex) {
+    for (int i = 0; i < NITER; i++) {
+        if (futex) mutex_lock(&shared->mtx);
+        else spin_lock();
+        shared->counter++;
+        if (futex) mutex_unlock(&shared->mtx);
+        else spin_unlock();
+    }
+}
+
+/* Every worker waits for its turn and passes it to the next one */
+static void
+token(uint32_t id) {
+    for (int i = 0; i < NROUNDS; i++) {
+        mutex_lock(&shared->mtx);
+        while (shared->turn % NWORKERS != id)
+            cond_wait(&shared->cv, &shared->mtx);
+        shared->turn++;
+        cond_broadcast(&shared->cv);
+        mutex_unlock(&shared->mtx);
+    }
+}
+
+static void
+run(const char *name, int mode) {
+    shared->counter = 0;
+    shared->turn = 0;
+    shared->done = 0;
+
+    uint64_t start = vsys_gettime();
+    for (uint32_t i = 0; i < NWORKERS; i++) {
+        envid_t id = fork();
+        if (id < 0) panic("fork: %i", id);
+        if (id) continue;
+
+        if (mode == 2) token(i);
+        else worker(mode);
+        __atomic_fetch_add(&shared->done, 1, __ATOMIC_RELEASE);
+        sys_futex_wake(&shared->done, 1);
+        exit();
+    }
+
+    uint32_t done;
+    while ((done = shared->done) != NWORKERS)
+        sys_futex_wait(&shared->done, done, 0);
+
+    uint64_t ns = vsys_gettime() - start;
+    uint64_t ops = mode == 2 ? NWORKERS * NROUNDS : NWORKERS * NITER;
+    if (mode != 2) assert(shared->counter == ops);
+    else assert(shared->turn == ops);
+
+    cprintf("futexbench: %s: %lu ns/op\n", name, (unsigned long)(ns / ops));
+}
+
+void
+umain(int argc, char **argv) {
+    int res = sys_alloc_region(CURENVID, shared, PAGE_SIZE, PROT_RW | PROT_SHARE);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+
+    /* Timeout and changed value */
+    assert(sys_futex_wait(&shared->done, 0, 1000000) == -E_TIMEOUT);
+    assert(sys_futex_wait(&shared->done, 1, 0) == -E_AGAIN);
+
+    run("spinlock+yield", 0);
+    run("futex mutex", 1);
+    run("condvar token passing", 2);
+}
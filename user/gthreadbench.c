@@ -0,0 +1,75 @@
+/* Green thread context switch and channel costs, and
+ * ipc_recv() blocking only the calling green thread */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSWITCH 100000
+#define NMSG    100000
+#define NSPIN   100
+
+static struct GChan chan;
+static volatile uint64_t spins;
+static volatile bool received;
+
+static void
+yielder(void *arg) {
+    for (int i = 0; i < NSWITCH; i++) gthread_yield();
+}
+
+static void
+producer(void *arg) {
+    for (uint64_t i = 0; i < NMSG; i++) gchan_send(&chan, i);
+}
+
+static void
+consumer(void *arg) {
+    for (uint64_t i = 0; i < NMSG; i++) assert(gchan_recv(&chan) == i);
+}
+
+static void
+receiver(void *arg) {
+    envid_t from;
+    assert(ipc_recv(&from, NULL, NULL, NULL) == 42);
+    assert(from == (envid_t)(uintptr_t)arg);
+    received = true;
+}
+
+static void
+spinner(void *arg) {
+    while (!received) {
+        spins++;
+        gthread_yield();
+    }
+}
+
+void
+umain(int argc, char **argv) {
+    uint64_t start = read_tsc();
+    gthread_create(yielder, NULL);
+    gthread_create(yielder, NULL);
+    gthread_wait_all();
+    cprintf("gthread switch: %lu cycles\n", (unsigned long)((read_tsc() - start) / (2 * NSWITCH)));
+
+    gchan_init(&chan);
+    start = read_tsc();
+    gthread_create(producer, NULL);
+    gthread_create(consumer, NULL);
+    gthread_wait_all();
+    cprintf("gchan message: %lu cycles\n", (unsigned long)((read_tsc() - start) / NMSG));
+
+    envid_t parent = sys_getenvid();
+    envid_t child = fork();
+    if (child < 0) panic("fork: %i", child);
+    if (!child) {
+        for (int i = 0; i < NSPIN; i++) sys_yield();
+        ipc_send(parent, 42, NULL, 0, 0);
+        return;
+    }
+
+    gthread_create(receiver, (void *)(uintptr_t)child);
+    gthread_create(spinner, NULL);
+    gthread_wait_all();
+    assert(spins > 0);
+    cprintf("gthread ipc: %lu yields while receiving\n", (unsigned long)spins);
+}
@@ -0,0 +1,84 @@
+/* malloc()/free() throughput with random sizes over a working
+ * set of live objects, and memory return after everything is freed */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NLIVE  1024
+#define NOPS   200000
+#define NLARGE 64
+
+static uint8_t *live[NLIVE];
+static size_t sizes[NLIVE];
+static uint64_t seed = 1;
+
+static uint32_t
+next_rand(void) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+}
+
+/* Mostly small objects with a tail of larger ones */
+static size_t
+random_size(size_t max) {
+    size_t size = 16 << (next_rand() % 6);
+    return MIN(1 + next_rand() % size, max);
+}
+
+static void
+churn(const char *name, size_t max) {
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NOPS; i++) {
+        size_t slot = next_rand() % NLIVE;
+        if (live[slot]) {
+            assert(live[slot][0] == (uint8_t)slot && live[slot][sizes[slot] - 1] == (uint8_t)slot);
+            free(live[slot]);
+        }
+        sizes[slot] = random_size(max);
+        live[slot] = malloc(sizes[slot]);
+        assert(live[slot]);
+        live[slot][0] = live[slot][sizes[slot] - 1] = (uint8_t)slot;
+    }
+    uint64_t cycles = read_tsc() - start;
+
+    cprintf("%s: %lu cycles per malloc/free pair\n", name, (unsigned long)(cycles / NOPS));
+}
+
+void
+umain(int argc, char **argv) {
+    churn("small", 256);
+    churn("mixed", 16384);
+
+    /* Contents survive realloc() */
+    uint8_t *buf = NULL;
+    for (size_t size = 1; size <= 64 * 1024; size *= 2) {
+        buf = realloc(buf, size);
+        assert(buf);
+        buf[size - 1] = (uint8_t)size;
+        if (size > 1) assert(buf[size / 2 - 1] == (uint8_t)(size / 2));
+    }
+    free(buf);
+
+    uint32_t *zero = calloc(1000, sizeof(*zero));
+    for (size_t i = 0; i < 1000; i++) assert(!zero[i]);
+    free(zero);
+
+    uint64_t start = read_tsc();
+    static void *large[NLARGE];
+    for (size_t i = 0; i < NLARGE; i++) {
+        large[i] = malloc(256 * 1024);
+        assert(large[i]);
+        memset(large[i], 0xAA, 4096);
+    }
+    for (size_t i = 0; i < NLARGE; i++) free(large[i]);
+    cprintf("large: %lu cycles per 256K malloc/free pair\n",
+            (unsigned long)((read_tsc() - start) / NLARGE));
+
+    for (size_t i = 0; i < NLIVE; i++) free(live[i]);
+
+    struct MallocStats stats;
+    malloc_stats(&stats);
+    cprintf("slabs in use: %lu, released: %lu, large objects: %lu\n",
+            (unsigned long)stats.slabs, (unsigned long)stats.slabs_released, (unsigned long)stats.large);
+    assert(!stats.large && !stats.large_bytes);
+}
@@ -0,0 +1,52 @@
+/* Compare mapping many scattered pages with one sys_map_region()
+ * call per page and with a single sys_map_regions() call */
+
+#include <inc/lib.h>
+
+#define NREGIONS 512
+
+static uint8_t *const src = (uint8_t *)0x10000000;
+static uint8_t *const dst = (uint8_t *)0x20000000;
+
+static struct MapRegion vec[NREGIONS];
+
+static void
+check(void) {
+    for (size_t i = 0; i < NREGIONS; i++)
+        assert(dst[2 * i * PAGE_SIZE] == (uint8_t)i);
+    sys_unmap_region(CURENVID, dst, 2 * NREGIONS * PAGE_SIZE);
+}
+
+void
+umain(int argc, char **argv) {
+    int res = sys_alloc_region(CURENVID, src, NREGIONS * PAGE_SIZE, PROT_RW);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+    for (size_t i = 0; i < NREGIONS; i++)
+        src[i * PAGE_SIZE] = (uint8_t)i;
+
+    /* Every other page, so that regions cannot be merged */
+    uint64_t start = vsys_gettime();
+    for (size_t i = 0; i < NREGIONS; i++) {
+        res = sys_map_region(CURENVID, src + i * PAGE_SIZE, CURENVID, dst + 2 * i * PAGE_SIZE, PAGE_SIZE, PROT_RW | PROT_SHARE);
+        if (res < 0) panic("sys_map_region: %i", res);
+    }
+    uint64_t single_ns = vsys_gettime() - start;
+    check();
+
+    for (size_t i = 0; i < NREGIONS; i++)
+        vec[i] = (struct MapRegion){(uintptr_t)(src + i * PAGE_SIZE), (uintptr_t)(dst + 2 * i * PAGE_SIZE), PAGE_SIZE, PROT_RW | PROT_SHARE};
+
+    start = vsys_gettime();
+    res = sys_map_regions(CURENVID, CURENVID, vec, NREGIONS);
+    if (res < 0) panic("sys_map_regions: %i", res);
+    uint64_t vec_ns = vsys_gettime() - start;
+    check();
+
+    /* Invalid descriptor is rejected before its batch is applied */
+    vec[1].dst++;
+    assert(sys_map_regions(CURENVID, CURENVID, vec, 2) == -E_INVAL);
+    assert(!is_page_present(dst));
+
+    cprintf("mapvbench: %d regions, sys_map_region %lu ns, sys_map_regions %lu ns\n",
+            NREGIONS, (unsigned long)single_ns, (unsigned long)vec_ns);
+}
@@ -0,0 +1,94 @@
+/* Measure IPC throughput with NSENDERS senders and one receiver
+ * using rendezvous ipc_recv() and mailbox with batched receive */
+
+#include <inc/lib.h>
+
+#define NSENDERS 4
+#define NMSGS    2000
+#define DEPTH    32
+#define BATCH    16
+
+static uint8_t *const grant_window = (uint8_t *)0x10000000;
+static uint8_t *const send_page = (uint8_t *)0x20000000;
+
+static envid_t receiver;
+
+/* try_send: 0 - blocking ipc_send(), 1 - sys_ipc_try_send() retrying on full mailbox */
+static void
+spawn_senders(int try_send) {
+    for (int i = 0; i < NSENDERS; i++) {
+        envid_t id = fork();
+        if (id < 0) panic("fork: %i", id);
+        if (id) continue;
+
+        for (uint32_t j = 0; j < NMSGS; j++) {
+            if (!try_send) {
+                ipc_send(receiver, j, NULL, 0, 0);
+                continue;
+            }
+
+            int res;
+            while ((res = sys_ipc_try_send(receiver, j, NULL, 0, 0)) == -E_MAILBOX_FULL) sys_yield();
+            if (res < 0) panic("sys_ipc_try_send: %i", res);
+        }
+        exit();
+    }
+}
+
+static void
+report(const char *name, uint64_t start) {
+    uint64_t ns = vsys_gettime() - start;
+    if (!ns) ns = 1;
+    cprintf("%s: %lu messages/s\n", name, (unsigned long)(NSENDERS * NMSGS * 1000000000ULL / ns));
+}
+
+static void
+check_grant(void) {
+    envid_t id = fork();
+    if (id < 0) panic("fork: %i", id);
+    if (!id) {
+        int res = sys_alloc_region(CURENVID, send_page, PAGE_SIZE, PROT_RW);
+        if (res < 0) panic("sys_alloc_region: %i", res);
+        strcpy((char *)send_page, "granted");
+        ipc_send(receiver, 1, send_page, PAGE_SIZE, PROT_RW);
+        exit();
+    }
+
+    struct IpcMessage msg;
+    ipc_recv_batch(&msg, 1);
+    assert(msg.from == id && msg.value == 1 && msg.size == PAGE_SIZE);
+    assert(msg.va == (uintptr_t)grant_window);
+    assert(!strcmp((char *)msg.va, "granted"));
+    sys_unmap_region(CURENVID, (void *)msg.va, msg.size);
+}
+
+void
+umain(int argc, char **argv) {
+    receiver = thisenv->env_id;
+
+    spawn_senders(0);
+    uint64_t start = vsys_gettime();
+    for (int i = 0; i < NSENDERS * NMSGS; i++)
+        ipc_recv(NULL, NULL, NULL, NULL);
+    report("rendezvous", start);
+
+    int res = sys_ipc_mailbox(DEPTH, grant_window, PAGE_SIZE);
+    if (res < 0) panic("sys_ipc_mailbox: %i", res);
+    check_grant();
+
+    struct IpcMessage msgs[BATCH];
+    spawn_senders(0);
+    start = vsys_gettime();
+    for (int n = 0; n < NSENDERS * NMSGS;)
+        n += ipc_recv_batch(msgs, BATCH);
+    report("mailbox", start);
+
+    spawn_senders(1);
+    start = vsys_gettime();
+    for (int n = 0; n < NSENDERS * NMSGS;)
+        n += ipc_recv_batch(msgs, BATCH);
+    report("mailbox, try_send", start);
+    cprintf("mailbox overflows: %lu\n", (unsigned long)thisenv->env_mbox_overflows);
+
+    sys_ipc_mailbox(0, NULL, 0);
+}
@@ -0,0 +1,67 @@
+/* Hand a buffer off to a consumer that writes every page of it
+ * with copy-on-write transfer and with MAP_MOVE transfer */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NPAGES 256
+#define SIZE   (NPAGES * PAGE_SIZE)
+
+static uint8_t *const buf = (uint8_t *)0x10000000;
+
+static _Noreturn void
+consumer(void) {
+    for (;;) {
+        envid_t who;
+        size_t size = SIZE;
+        int perm;
+        ipc_recv(&who, buf, &size, &perm);
+        assert(size == SIZE);
+
+        uint64_t start = read_tsc();
+        for (size_t i = 0; i < SIZE; i += PAGE_SIZE) {
+            assert(buf[i] == (uint8_t)(i / PAGE_SIZE));
+            buf[i] = 0;
+        }
+        uint64_t cycles = read_tsc() - start;
+
+        sys_unmap_region(CURENVID, buf, SIZE);
+        ipc_send(who, cycles / NPAGES, NULL, 0, 0);
+    }
+}
+
+static void
+produce(envid_t to, const char *name, int perm) {
+    int res = sys_alloc_region(CURENVID, buf, SIZE, PROT_RW);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+    for (size_t i = 0; i < SIZE; i += PAGE_SIZE)
+        buf[i] = (uint8_t)(i / PAGE_SIZE);
+
+    ipc_send(to, 0, buf, SIZE, perm);
+    int32_t cycles = ipc_recv(NULL, NULL, NULL, NULL);
+
+    if (perm & MAP_MOVE) {
+        /* Region is not ours anymore */
+        for (size_t i = 0; i < SIZE; i += PAGE_SIZE)
+            assert(!is_page_present(buf + i));
+    } else {
+        /* Our copy is intact */
+        for (size_t i = 0; i < SIZE; i += PAGE_SIZE)
+            assert(buf[i] == (uint8_t)(i / PAGE_SIZE));
+        sys_unmap_region(CURENVID, buf, SIZE);
+    }
+
+    cprintf("%s: consumer write %d cycles per page\n", name, cycles);
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t id = fork();
+    if (id < 0) panic("fork: %i", id);
+    if (!id) consumer();
+
+    produce(id, "copy-on-write", PROT_RW | PROT_LAZY);
+    produce(id, "move", PROT_RW | MAP_MOVE);
+
+    sys_env_destroy(id);
+}
@@ -0,0 +1,51 @@
+/* Measure null system call latency through
+ * int $T_SYSCALL and SYSCALL instruction entry paths */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER 100000
+
+static envid_t
+getenvid_int(void) {
+    uintptr_t ret;
+    asm volatile("int %1\n"
+                 : "=a"(ret)
+                 : "i"(T_SYSCALL), "a"(SYS_getenvid)
+                 : "cc", "memory");
+    return ret;
+}
+
+static envid_t
+getenvid_fast(void) {
+    uintptr_t ret;
+    asm volatile("syscall\n"
+                 : "=a"(ret)
+                 : "a"(SYS_getenvid)
+                 : "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11", "cc", "memory");
+    return ret;
+}
+
+static uint64_t
+measure(envid_t (*fn)(void), envid_t expected) {
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NITER; i++)
+        if (fn() != expected) panic("unexpected envid");
+    return (read_tsc() - start) / NITER;
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t envid = thisenv->env_id;
+
+    cprintf("nullsyscall: int %lu cycles\n", (unsigned long)measure(getenvid_int, envid));
+
+    uint32_t features;
+    cpuid(0x80000001, NULL, NULL, NULL, &features);
+    if (!(features & CPUID_EXT_SYSCALL)) {
+        cprintf("nullsyscall: SYSCALL is not supported\n");
+        return;
+    }
+
+    cprintf("nullsyscall: syscall %lu cycles\n", (unsigned long)measure(getenvid_fast, envid));
+}
@@ -0,0 +1,56 @@
+/* Measure IPC round trip latency between client and server
+ * with ipc_send()/ipc_recv() pairs and with ipc_call()/ipc_reply_and_recv() */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER 10000
+
+static _Noreturn void
+recv_server(void) {
+    envid_t who;
+    for (;;) {
+        int32_t value = ipc_recv(&who, NULL, NULL, NULL);
+        ipc_send(who, value + 1, NULL, 0, 0);
+    }
+}
+
+static _Noreturn void
+call_server(void) {
+    envid_t who;
+    int32_t value = ipc_reply_and_recv(0, 0, &who, NULL, NULL, NULL);
+    for (;;) {
+        value = ipc_reply_and_recv(who, value + 1, &who, NULL, NULL, NULL);
+        if (value < 0) panic("ipc_reply_and_recv: %i", value);
+    }
+}
+
+static envid_t
+spawn(void (*server)(void)) {
+    envid_t id = fork();
+    if (id < 0) panic("fork: %i", id);
+    if (!id) server();
+    return id;
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t server = spawn(recv_server);
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NITER; i++) {
+        ipc_send(server, i, NULL, 0, 0);
+        if (ipc_recv(NULL, NULL, NULL, NULL) != i + 1) panic("unexpected reply");
+    }
+    uint64_t send_cycles = (read_tsc() - start) / NITER;
+    sys_env_destroy(server);
+
+    server = spawn(call_server);
+    start = read_tsc();
+    for (int i = 0; i < NITER; i++)
+        if (ipc_call(server, i, NULL, 0, 0) != i + 1) panic("unexpected reply");
+    uint64_t call_cycles = (read_tsc() - start) / NITER;
+    sys_env_destroy(server);
+
+    cprintf("pingpongbench: send/recv %lu cycles, call/reply %lu cycles per round trip\n",
+            (unsigned long)send_cycles, (unsigned long)call_cycles);
+}
@@ -10,41 +10,64 @@
 
 #include <inc/lib.h>
 
+/* Numbers flow between neighbors through shared memory channels
+ * (see lib/chan.c) instead of one IPC per number. Every stage
+ * reads from the channel its parent created at one of these
+ * addresses and creates its output channel at the other one. */
+static struct Chan *const chans[2] = {
+        (struct Chan *)0x10000000,
+        (struct Chan *)0x10010000,
+};
+
+static struct Chan *
+new_chan(struct Chan *ch) {
+    int res = chan_create(ch);
+    if (res < 0)
+        panic("chan_create: %i", res);
+    return ch;
+}
+
 unsigned
-primeproc(void) {
+primeproc(struct Chan *in) {
     int i, id, p;
-    envid_t envid;
+    struct Chan *out;
 
     /* Fetch a prime from our left neighbor */
 top:
-    p = ipc_recv(&envid, 0, 0, 0);
+    p = chan_recv(in);
     cprintf("%d ", p);
 
     /* Fork a right neighbor to continue the chain */
+    out = new_chan(in == chans[0] ? chans[1] : chans[0]);
     if ((id = fork()) < 0)
         panic("fork: %i", id);
-    if (id == 0)
+    if (id == 0) {
+        /* Left neighbor's channel is not ours */
+        chan_destroy(in);
+        in = out;
         goto top;
+    }
 
     /* Filter out multiples of our prime */
     while (1) {
-        i = ipc_recv(&envid, 0, 0, 0);
+        i = chan_recv(in);
         if (i % p)
-            ipc_send(id, i, 0, 0, 0);
+            chan_send(out, i);
     }
 }
 
 void
 umain(int argc, char **argv) {
     int id;
+    struct Chan *out = new_chan(chans[0]);
 
     /* Fork the first prime process in the chain */
     if ((id = fork()) < 0)
         panic("fork: %i", id);
     if (id == 0)
-        primeproc();
+        primeproc(out);
 
     /* Feed all the integers through */
     for (int i = 2;; i++)
-        ipc_send(id, i, 0, 0, 0);
+        chan_send(out, i);
 }
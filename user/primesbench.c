@@ -0,0 +1,144 @@
+/* Run primes pipeline (see user/primes.c) over integers below LIMIT
+ * with blocking ipc_send(), with a send loop around sys_ipc_try_send()
+ * and sys_yield(), and with shared memory channels (lib/chan.c),
+ * and compare time and scheduler activity per prime. */
+
+#include <inc/lib.h>
+
+#define LIMIT 1000
+
+enum Mode {
+    MODE_BLOCKING,
+    MODE_SPIN,
+    MODE_CHAN,
+};
+
+static const char *const mode_names[] = {
+        [MODE_BLOCKING] = "blocking send",
+        [MODE_SPIN] = "try_send+yield",
+        [MODE_CHAN] = "channels",
+};
+
+static envid_t generator;
+static enum Mode mode;
+
+/* Channels of MODE_CHAN: stages alternate between the first two
+ * like user/primes, the last one returns the result */
+static struct Chan *const chans[3] = {
+        (struct Chan *)0x10000000,
+        (struct Chan *)0x10010000,
+        (struct Chan *)0x10020000,
+};
+static struct Chan *in;
+
+static void
+new_chan(struct Chan *ch) {
+    int res = chan_create(ch);
+    if (res < 0) panic("chan_create: %i", res);
+}
+
+static void
+send(envid_t to, uint32_t value) {
+    if (mode == MODE_BLOCKING) {
+        ipc_send(to, value, NULL, 0, 0);
+        return;
+    }
+
+    int res;
+    while ((res = sys_ipc_try_send(to, value, (void *)(MAX_USER_ADDRESS + 1), 0, 0)) == -E_IPC_NOT_RECV)
+        sys_yield();
+    if (res < 0) panic("sys_ipc_try_send: %i", res);
+}
+
+static uint32_t
+recv(void) {
+    if (mode == MODE_CHAN) return chan_recv(in);
+    return ipc_recv(NULL, 0, 0, 0);
+}
+
+/* 0 terminates the pipeline, the stage that gets it
+ * first reports number of primes to the generator */
+static void
+primeproc(void) {
+    struct Chan *out = NULL;
+    envid_t id;
+    int depth = 0, p;
+
+top:
+    p = recv();
+    if (!p) {
+        if (mode == MODE_CHAN)
+            chan_send(chans[2], depth);
+        else
+            send(generator, depth);
+        exit();
+    }
+
+    if (mode == MODE_CHAN) {
+        out = in == chans[0] ? chans[1] : chans[0];
+        new_chan(out);
+    }
+    if ((id = fork()) < 0) panic("fork: %i", id);
+    if (!id) {
+        if (mode == MODE_CHAN) {
+            chan_destroy(in);
+            in = out;
+        }
+        depth++;
+        goto top;
+    }
+
+    for (;;) {
+        int i = recv();
+        if (!i || i % p) {
+            if (mode == MODE_CHAN)
+                chan_send(out, i);
+            else
+                send(id, i);
+        }
+        if (!i) exit();
+    }
+}
+
+static void
+run(enum Mode run_mode) {
+    mode = run_mode;
+    generator = thisenv->env_id;
+    if (mode == MODE_CHAN) {
+        in = chans[0];
+        new_chan(chans[0]);
+        new_chan(chans[2]);
+    }
+
+    uint64_t start = vsys_gettime(), ticks = vsys_ticks();
+
+    envid_t id = fork();
+    if (id < 0) panic("fork: %i", id);
+    if (!id) primeproc();
+
+    for (int i = 2; i <= LIMIT; i++) {
+        uint32_t value = i < LIMIT ? i : 0;
+        if (mode == MODE_CHAN)
+            chan_send(chans[0], value);
+        else
+            send(id, value);
+    }
+
+    int nprimes = mode == MODE_CHAN ? (int)chan_recv(chans[2]) : ipc_recv(NULL, 0, 0, 0);
+    uint64_t ns = vsys_gettime() - start;
+
+    cprintf("primesbench: %s: %d primes, %lu ns/prime, %lu ticks\n", mode_names[mode],
+            nprimes, (unsigned long)(ns / (nprimes ? nprimes : 1)), (unsigned long)(vsys_ticks() - ticks));
+
+    if (mode == MODE_CHAN) {
+        chan_destroy(chans[0]);
+        chan_destroy(chans[2]);
+    }
+}
+
+void
+umain(int argc, char **argv) {
+    run(MODE_BLOCKING);
+    run(MODE_SPIN);
+    run(MODE_CHAN);
+}
@@ -0,0 +1,73 @@
+/* Compare throughput of mapping and unmapping many small regions
+ * with individual system calls and through batched system call ring */
+
+#include <inc/lib.h>
+
+#define NREGIONS 1024
+
+static uint8_t *const region = (uint8_t *)0x10000000;
+
+static __attribute__((aligned(PAGE_SIZE))) struct SysRing ring;
+
+static size_t ncompleted;
+
+static void
+reap(void) {
+    struct SysCompletion cqe;
+    while (sysring_complete(&ring, &cqe)) {
+        if (cqe.result < 0) panic("ring entry %lu: %i", (unsigned long)cqe.user_data, (int)cqe.result);
+        ncompleted++;
+    }
+}
+
+static void
+submit(int num, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4) {
+    int res;
+    while ((res = sysring_submit(&ring, ncompleted, num, a1, a2, a3, a4, 0, 0)) == -E_NO_MEM)
+        reap();
+    if (res < 0) panic("sysring_submit: %i", res);
+}
+
+static void
+finish(size_t expected) {
+    while (ncompleted < expected) {
+        int res = sys_ring_enter();
+        if (res < 0) panic("sys_ring_enter: %i", res);
+        reap();
+    }
+}
+
+static void
+report(const char *name, uint64_t ns) {
+    cprintf("ringbench: %s %lu ops/s\n", name, (unsigned long)(2 * NREGIONS * 1000000000ULL / (ns ? ns : 1)));
+}
+
+void
+umain(int argc, char **argv) {
+    uint64_t start = vsys_gettime();
+    for (size_t i = 0; i < NREGIONS; i++) {
+        int res = sys_alloc_region(CURENVID, region + i * PAGE_SIZE, PAGE_SIZE, PROT_RW);
+        if (res < 0) panic("sys_alloc_region: %i", res);
+    }
+    for (size_t i = 0; i < NREGIONS; i++)
+        sys_unmap_region(CURENVID, region + i * PAGE_SIZE, PAGE_SIZE);
+    report("syscalls", vsys_gettime() - start);
+
+    int res = sysring_init(&ring);
+    if (res < 0) panic("sysring_init: %i", res);
+
+    start = vsys_gettime();
+    for (size_t i = 0; i < NREGIONS; i++)
+        submit(SYS_alloc_region, CURENVID, (uintptr_t)(region + i * PAGE_SIZE), PAGE_SIZE, PROT_RW);
+    finish(NREGIONS);
+    for (size_t i = 0; i < NREGIONS; i++)
+        submit(SYS_unmap_region, CURENVID, (uintptr_t)(region + i * PAGE_SIZE), PAGE_SIZE, 0);
+    finish(2 * NREGIONS);
+    report("ring", vsys_gettime() - start);
+
+    /* Unsupported entries complete with an error */
+    assert(!sysring_submit(&ring, 0, SYS_yield, 0, 0, 0, 0, 0, 0));
+    assert(sys_ring_enter() == 1);
+    struct SysCompletion cqe;
+    assert(sysring_complete(&ring, &cqe) && cqe.result == -E_INVAL);
+}
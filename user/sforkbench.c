@@ -0,0 +1,82 @@
+/* Compare creation cost of fork() and sfork() children that
+ * write every page of a working set, and check that sfork()
+ * children share memory but not the stack and TLS. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NPAGES  256
+#define NROUNDS 32
+
+static uint8_t *const heap = (uint8_t *)0x10000000;
+
+static volatile uint64_t counter;
+static int key;
+
+static void
+child(void) {
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < NPAGES; i++)
+        heap[i * PAGE_SIZE]++;
+    uint64_t cycles = read_tsc() - start;
+
+    __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+    ipc_send(thisenv->env_parent_id, cycles / NPAGES, NULL, 0, 0);
+}
+
+static void
+run(const char *name, envid_t (*create)(void)) {
+    uint64_t create_cycles = 0, write_cycles = 0;
+
+    counter = 0;
+    for (int i = 0; i < NROUNDS; i++) {
+        uint64_t start = read_tsc();
+        envid_t envid = create();
+        if (!envid) {
+            child();
+            exit();
+        }
+        create_cycles += read_tsc() - start;
+
+        envid_t from;
+        write_cycles += ipc_recv(&from, NULL, NULL, NULL);
+        assert(from == envid);
+    }
+
+    cprintf("%s: %lu cycles to create, %lu cycles per page written, %lu children seen by parent\n",
+            name, (unsigned long)(create_cycles / NROUNDS),
+            (unsigned long)(write_cycles / NROUNDS), (unsigned long)counter);
+}
+
+void
+umain(int argc, char **argv) {
+    int res = sys_alloc_region(CURENVID, heap, NPAGES * PAGE_SIZE, PROT_RW);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+    memset(heap, 0, NPAGES * PAGE_SIZE);
+
+    key = tls_key_create();
+    assert(key >= 0);
+    tls_set(key, (void *)1);
+
+    /* fork() first, sfork() makes memory shared with later forks */
+    run("fork", fork);
+    assert(counter == 0 && heap[0] == 0);
+
+    run("sfork", sfork);
+    assert(counter == NROUNDS && heap[0] == NROUNDS);
+
+    envid_t envid = sfork();
+    if (!envid) {
+        /* Stack and TLS are private */
+        assert(thisenv->env_id == sys_getenvid());
+        assert(tls_get(key) == (void *)1);
+        tls_set(key, (void *)2);
+        ipc_send(thisenv->env_parent_id, 0, NULL, 0, 0);
+        return;
+    }
+    ipc_recv(NULL, NULL, NULL, NULL);
+    assert(thisenv->env_id == sys_getenvid());
+    assert(tls_get(key) == (void *)1);
+
+    cprintf("sforkbench done\n");
+}
@@ -0,0 +1,62 @@
+/* Measure snapshot restore latency against working set size.
+ * Worker env touches a region, then parent takes its snapshot.
+ * On every round worker dirties given number of pages and
+ * parent reverts it back with sys_env_restore(). */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NPAGES  1024
+#define NROUNDS 16
+
+static uint8_t *const region = (uint8_t *)0x10000000;
+
+static void
+worker(envid_t parent) {
+    int res = sys_alloc_region(CURENVID, region, NPAGES * PAGE_SIZE, PROT_RW);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+    for (size_t i = 0; i < NPAGES; i++)
+        region[i * PAGE_SIZE] = 0;
+
+    for (;;) {
+        uint32_t n = ipc_recv(NULL, NULL, NULL, NULL);
+        for (size_t i = 0; i < n; i++)
+            assert(region[i * PAGE_SIZE]++ == 0);
+        ipc_send(parent, 0, NULL, 0, 0);
+    }
+}
+
+static void
+wait_recving(envid_t envid) {
+    while (!envs[ENVX(envid)].env_ipc_recving)
+        sys_yield();
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t parent = sys_getenvid();
+    envid_t envid = fork();
+    if (envid < 0) panic("fork: %i", envid);
+    if (!envid) worker(parent);
+
+    wait_recving(envid);
+    int res = sys_env_snapshot(envid);
+    if (res < 0) panic("sys_env_snapshot: %i", res);
+
+    for (uint32_t n = 1; n <= NPAGES; n *= 4) {
+        uint64_t cycles = 0;
+        for (int i = 0; i < NROUNDS; i++) {
+            ipc_send(envid, n, NULL, 0, 0);
+            ipc_recv(NULL, NULL, NULL, NULL);
+            wait_recving(envid);
+
+            uint64_t start = read_tsc();
+            res = sys_env_restore(envid);
+            cycles += read_tsc() - start;
+            if (res < 0) panic("sys_env_restore: %i", res);
+        }
+        cprintf("snapbench: %u dirty pages, restore %lu cycles\n", n, (unsigned long)(cycles / NROUNDS));
+    }
+
+    sys_env_destroy(envid);
+}
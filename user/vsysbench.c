@@ -0,0 +1,37 @@
+/* Compare reading environment id and time through
+ * UVSYS page with corresponding system calls */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER 100000
+
+void
+umain(int argc, char **argv) {
+    envid_t envid = sys_getenvid();
+    assert(vsys_getenvid() == envid);
+
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NITER; i++)
+        if (sys_getenvid() != envid) panic("sys_getenvid");
+    uint64_t sys_cycles = (read_tsc() - start) / NITER;
+
+    start = read_tsc();
+    for (int i = 0; i < NITER; i++)
+        if (vsys_getenvid() != envid) panic("vsys_getenvid");
+    uint64_t vsys_cycles = (read_tsc() - start) / NITER;
+
+    cprintf("vsysbench: getenvid syscall %lu cycles, vsys %lu cycles\n",
+            (unsigned long)sys_cycles, (unsigned long)vsys_cycles);
+
+    /* Clock is monotonic and advances while we are descheduled */
+    uint64_t time = vsys_gettime(), ticks = vsys_ticks();
+    uint32_t runs = vsys_env_runs();
+    sys_yield();
+    uint64_t now = vsys_gettime();
+    assert(now >= time);
+
+    cprintf("vsysbench: yield took %lu ns, ticks %lu -> %lu, runs %u -> %u\n",
+            (unsigned long)(now - time), (unsigned long)ticks, (unsigned long)vsys_ticks(),
+            runs, vsys_env_runs());
+}
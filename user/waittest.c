@@ -0,0 +1,64 @@
+/* Test sys_wait(): event loop waiting on a timer, IPC
+ * from any or a specific sender and a shared futex word. */
+
+#include <inc/lib.h>
+
+#define MS 1000000ULL
+
+static volatile uint32_t *const word = (volatile uint32_t *)0x10000000;
+
+enum { EV_IPC, EV_CHILD, EV_FUTEX, EV_TIMER, NEVENTS };
+
+void
+umain(int argc, char **argv) {
+    int res = sys_alloc_region(CURENVID, (void *)word, PAGE_SIZE, PROT_RW | PROT_SHARE);
+    if (res < 0) panic("sys_alloc_region: %i", res);
+
+    envid_t parent = sys_getenvid();
+    envid_t child = fork();
+    if (child < 0) panic("fork: %i", child);
+    if (!child) {
+        /* Let the parent block first */
+        sys_yield();
+        ipc_send(parent, 1, NULL, 0, 0);
+
+        *word = 1;
+        sys_futex_wake(word, 1);
+        return;
+    }
+
+    struct WaitEvent events[NEVENTS] = {
+            [EV_IPC] = {.type = WAIT_IPC},
+            [EV_CHILD] = {.type = WAIT_IPC, .envid = child},
+            [EV_FUTEX] = {.type = WAIT_FUTEX, .addr = (uintptr_t)word, .value = 0},
+            [EV_TIMER] = {.type = WAIT_TIMER, .deadline = vsys_gettime() + 100 * MS},
+    };
+
+    res = sys_wait(events, NEVENTS);
+    assert(res == (1 << EV_IPC | 1 << EV_CHILD));
+    envid_t from;
+    assert(ipc_recv(&from, NULL, NULL, NULL) == 1 && from == child);
+    cprintf("wait: ipc ok\n");
+
+    /* Filtered sender doesn't match */
+    events[EV_CHILD].envid = parent;
+    res = sys_wait(events + EV_CHILD, NEVENTS - EV_CHILD);
+    assert(res == 1 << (EV_FUTEX - EV_CHILD));
+    assert(*word == 1);
+    cprintf("wait: futex ok\n");
+
+    /* Word still differs, ready right away */
+    assert(sys_wait(events + EV_FUTEX, 1) == 1);
+
+    uint64_t start = vsys_gettime();
+    events[EV_TIMER].deadline = start + 50 * MS;
+    res = sys_wait(events + EV_TIMER, 1);
+    assert(res == 1 && vsys_gettime() >= start + 50 * MS);
+    cprintf("wait: timer ok\n");
+
+    struct WaitEvent bad = {.type = WAIT_FUTEX, .addr = (uintptr_t)word + 1};
+    assert(sys_wait(&bad, 1) == -E_INVAL);
+    assert(sys_wait(events, 0) == -E_INVAL);
+
+    cprintf("wait done\n");
+}